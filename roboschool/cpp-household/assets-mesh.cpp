@@ -9,7 +9,7 @@
 namespace Household {
 
 static
-void mesh_push_vertex(const shared_ptr<Shape>& m, const aiMesh* aimesh, int vind, btScalar scale)
+void mesh_push_vertex(Shape* m, const aiMesh* aimesh, int vind, btScalar scale)
 {
 	m->v.push_back(aimesh->mVertices[vind][0]*scale);
 	m->v.push_back(aimesh->mVertices[vind][1]*scale);
@@ -53,7 +53,7 @@ void Shape::push_lines(btScalar x, btScalar y, btScalar z)
 }
 
 static
-void mesh_push_line(const shared_ptr<Shape>& m, const aiMesh* aimesh, int vind1, int vind2, btScalar scale)
+void mesh_push_line(Shape* m, const aiMesh* aimesh, int vind1, int vind2, btScalar scale)
 {
 	m->lines.push_back(aimesh->mVertices[vind1][0]*scale);
 	m->lines.push_back(aimesh->mVertices[vind1][1]*scale);
@@ -63,6 +63,29 @@ void mesh_push_line(const shared_ptr<Shape>& m, const aiMesh* aimesh, int vind1,
 	m->lines.push_back(aimesh->mVertices[vind2][2]*scale);
 }
 
+static
+void mesh_fill(Shape* mesh, const aiMesh* aimesh1, const aiMesh* aimesh2, btScalar scale, const std::string& fn)
+{
+	for (int v=0; v<(int)aimesh2->mNumVertices; v++) {
+		mesh->raw_vertexes.push_back(aimesh2->mVertices[v][0]*scale);
+		mesh->raw_vertexes.push_back(aimesh2->mVertices[v][1]*scale);
+		mesh->raw_vertexes.push_back(aimesh2->mVertices[v][2]*scale);
+	}
+	for (int f=0; f<(int)aimesh1->mNumFaces; f++) {
+		const aiFace& face = aimesh1->mFaces[f];
+		if (face.mNumIndices==3) {
+			mesh_push_vertex(mesh, aimesh1, face.mIndices[0], scale);
+			mesh_push_vertex(mesh, aimesh1, face.mIndices[1], scale);
+			mesh_push_vertex(mesh, aimesh1, face.mIndices[2], scale);
+			mesh_push_line(mesh, aimesh1, face.mIndices[0], face.mIndices[1], scale);
+			mesh_push_line(mesh, aimesh1, face.mIndices[1], face.mIndices[2], scale);
+			mesh_push_line(mesh, aimesh1, face.mIndices[2], face.mIndices[0], scale);
+		} else {
+			fprintf(stderr, "%s mesh face with %i verts\n", fn.c_str(), face.mNumIndices);
+		}
+	}
+}
+
 bool load_collision_shape_from_OFF_files(const shared_ptr<ShapeDetailLevels>& result, const std::string& fn_template, btScalar scale, const btTransform& viz_frame)
 {
 	for (int c=0; c<50; c++) {
@@ -76,11 +99,9 @@ bool load_collision_shape_from_OFF_files(const shared_ptr<ShapeDetailLevels>& re
 	return false;
 }
 
-void load_model(const shared_ptr<ShapeDetailLevels>& result, const std::string& fn, btScalar scale, const btTransform& transform)
+static
+void load_two_scenes(Assimp::Importer& importer1, Assimp::Importer& importer2, const std::string& fn, const aiScene** scene1_, const aiScene** scene2_)
 {
-	//fprintf(stderr, "Loading model '%s' (takes some time, should not happen when learning without rendering)\n", fn.c_str());
-	Assimp::Importer importer1;
-	std::string ext = fn.substr(fn.size()-3,  3);
 	aiMatrix4x4 root_trans;
 	importer1.SetPropertyInteger(AI_CONFIG_PP_PTV_ADD_ROOT_TRANSFORMATION, 1);
 	importer1.SetPropertyMatrix(AI_CONFIG_PP_PTV_ROOT_TRANSFORMATION, root_trans); // setting identity matrix helps to load .dae, resulting model turned on the side without it
@@ -91,12 +112,24 @@ void load_model(const shared_ptr<ShapeDetailLevels>& result, const std::string&
 	if (!scene1) throw std::runtime_error("cannot load '" + fn + "': " + std::string(importer1.GetErrorString()) );
 	if (scene1->mNumMeshes==0 && scene1->mMaterials==0) throw std::runtime_error("cannot load '" + fn + "': model empty");
 
-	Assimp::Importer importer2;
 	importer2.SetPropertyInteger(AI_CONFIG_PP_PTV_ADD_ROOT_TRANSFORMATION, 1);
 	importer2.SetPropertyMatrix(AI_CONFIG_PP_PTV_ROOT_TRANSFORMATION, root_trans);
 	const aiScene* scene2 = importer2.ReadFile(fn, aiProcess_JoinIdenticalVertices | aiProcess_PreTransformVertices);
 	assert(scene2->mNumMaterials==scene1->mNumMaterials);
 	assert(scene2->mNumMeshes==scene1->mNumMeshes);
+	*scene1_ = scene1;
+	*scene2_ = scene2;
+}
+
+void load_model(const shared_ptr<ShapeDetailLevels>& result, const std::string& fn, btScalar scale, const btTransform& transform)
+{
+	//fprintf(stderr, "Loading model '%s' (takes some time, should not happen when learning without rendering)\n", fn.c_str());
+	Assimp::Importer importer1;
+	Assimp::Importer importer2;
+	std::string ext = fn.substr(fn.size()-3,  3);
+	const aiScene* scene1;
+	const aiScene* scene2;
+	load_two_scenes(importer1, importer2, fn, &scene1, &scene2);
 
 	std::vector<shared_ptr<Material>> materials;
 	if (!result->materials || ext=="dae")  // Texture names tend to repeat in .dae, for example "Material_001", cannot be made common for the whole robot
@@ -138,25 +171,11 @@ void load_model(const shared_ptr<ShapeDetailLevels>& result, const std::string&
 		const aiMesh* aimesh2 = scene2->mMeshes[c];
 		shared_ptr<Shape> mesh(new Shape);
 		mesh->origin = transform;
-		for (int v=0; v<(int)aimesh2->mNumVertices; v++) {
-			mesh->raw_vertexes.push_back(aimesh2->mVertices[v][0]*scale);
-			mesh->raw_vertexes.push_back(aimesh2->mVertices[v][1]*scale);
-			mesh->raw_vertexes.push_back(aimesh2->mVertices[v][2]*scale);
-		}
 		mesh->material = materials[aimesh1->mMaterialIndex];
-		for (int f=0; f<(int)aimesh1->mNumFaces; f++) {
-			const aiFace& face = aimesh1->mFaces[f];
-			if (face.mNumIndices==3) {
-				mesh_push_vertex(mesh, aimesh1, face.mIndices[0], scale);
-				mesh_push_vertex(mesh, aimesh1, face.mIndices[1], scale);
-				mesh_push_vertex(mesh, aimesh1, face.mIndices[2], scale);
-				mesh_push_line(mesh, aimesh1, face.mIndices[0], face.mIndices[1], scale);
-				mesh_push_line(mesh, aimesh1, face.mIndices[1], face.mIndices[2], scale);
-				mesh_push_line(mesh, aimesh1, face.mIndices[2], face.mIndices[0], scale);
-			} else {
-				fprintf(stderr, "%s mesh face with %i verts\n", fn.c_str(), face.mNumIndices);
-			}
-		}
+		mesh->mesh_source_fn = fn;
+		mesh->mesh_source_scale = scale;
+		mesh->mesh_source_n = c;
+		mesh_fill(mesh.get(), aimesh1, aimesh2, scale, fn);
 		if (mesh->v.size())
 			result->detail_levels[DETAIL_BEST].push_back(mesh);
 		//printf("%s mesh %i\n%5i raw vertexes, %5i vertexes in triangles, %5i vertexes in quads\n",
@@ -164,6 +183,91 @@ void load_model(const shared_ptr<ShapeDetailLevels>& result, const std::string&
 	}
 }
 
+void load_model_mesh(Shape* mesh, const std::string& fn, btScalar scale, int mesh_n)
+{
+	Assimp::Importer importer1;
+	Assimp::Importer importer2;
+	const aiScene* scene1;
+	const aiScene* scene2;
+	load_two_scenes(importer1, importer2, fn, &scene1, &scene2);
+	if (mesh_n < 0 || mesh_n >= (int)scene1->mNumMeshes)
+		throw std::runtime_error("cannot load '" + fn + "': mesh index out of range, file changed on disk?");
+	mesh_fill(mesh, scene1->mMeshes[mesh_n], scene2->mMeshes[mesh_n], scale, fn);
+}
+
+size_t Shape::cpu_bytes() const
+{
+	return
+		raw_vertexes.capacity()*sizeof(btScalar) +
+		(v.capacity() + t.capacity() + norm.capacity() + lines.capacity())*sizeof(float);
+}
+
+template<class T>
+static void vector_free(std::vector<T>& v)
+{
+	std::vector<T> empty;
+	v.swap(empty);
+}
+
+void Shape::cpu_release()
+{
+	if (cpu_released) return;
+	if (primitive_type==STATIC_MESH || primitive_type==DEBUG_LINES) return; // no source to restore from
+	if (primitive_type==MESH && mesh_source_fn.empty()) return;
+	cpu_released_bytes = cpu_bytes();
+	vector_free(raw_vertexes);
+	vector_free(v);
+	vector_free(t);
+	vector_free(norm);
+	vector_free(lines);
+	cpu_released = true;
+}
+
+void Shape::cpu_restore()
+{
+	if (!cpu_released) return;
+	cpu_released = false;
+	cpu_released_bytes = 0;
+	if (primitive_type==MESH) {
+		load_model_mesh(this, mesh_source_fn, mesh_source_scale, mesh_source_n);
+	} else {
+		converted_to_mesh = false;
+		SimpleRender::primitive_to_mesh(this, primitive_detail);
+	}
+}
+
+void Shape::gpu_share(const shared_ptr<Shape>& src)
+{
+	vao.reset();
+	buf_v.reset();
+	buf_n.reset();
+	buf_t.reset();
+	gpu_bytes = 0;
+	gpu_residency_listed = false;
+	gpu_source.reset();
+	if (primitive_type!=MESH && primitive_type!=STATIC_MESH && !converted_to_mesh) return; // own vertexes generated later
+	gpu_source = src->gpu_source ? src->gpu_source : src;
+}
+
+void World::mesh_memory(size_t* cpu_bytes, size_t* gpu_bytes, size_t* cpu_released_bytes)
+{
+	std::set<Shape*> seen;
+	*cpu_bytes = 0;
+	*gpu_bytes = 0;
+	*cpu_released_bytes = 0;
+	for (auto i=klass_cache.begin(); i!=klass_cache.end(); ++i) {
+		shared_ptr<ThingyClass> klass = i->second.lock();
+		if (!klass || !klass->shapedet_visual) continue;
+		for (int lev=0; lev<DETAIL_LEVELS; lev++)
+		for (const shared_ptr<Shape>& shape: klass->shapedet_visual->detail_levels[lev]) {
+			if (!seen.insert(shape.get()).second) continue;
+			*cpu_bytes += shape->cpu_bytes();
+			*cpu_released_bytes += shape->cpu_released_bytes;
+			if (shape->vao) *gpu_bytes += shape->gpu_bytes;
+		}
+	}
+}
+
 //void Robot::replace_texture(const std::string& material_name, const std::string& texid)
 //{
 //	shared_ptr<MaterialNamespace> materials = root_part->klass->shapedet_visual->materials; // all parts share materials pointer
@@ -258,6 +362,7 @@ void Thingy::set_multiply_color(const std::string& tex, uint32_t* color, std::st
 				shared_ptr<Shape> alt_shape(new Shape);
 				*alt_shape = *shapes[c];
 				alt_shape->material = modified;
+				alt_shape->gpu_share(shapes[c]);
 				alt_shapes.push_back(alt_shape);
 			} else {
 				alt_shapes.push_back(shapes[c]);
@@ -5,8 +5,11 @@
 #include <list>
 #include <vector>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 
 namespace SimpleRender {
+struct Texture;
+struct VideoRecorder;
 struct VAO;
 struct Buffer;
 struct Context;
@@ -24,6 +27,7 @@ struct Material {
 	std::string name;
 	uint32_t texture = 0;
 	bool texture_loaded = false;
+	boost::weak_ptr<SimpleRender::Texture> texture_ref; // expires when texture evicted, see Context::residency_enforce()
 	std::string diffuse_texture_image_fn;
 	uint32_t diffuse_color  = 0x00FF00;
 	uint32_t multiply_color = 0xFFFFFF;
@@ -74,6 +78,25 @@ struct Shape {
 	shared_ptr<SimpleRender::Buffer> buf_n;
 	shared_ptr<SimpleRender::Buffer> buf_t;
 	shared_ptr<SimpleRender::Buffer> buf_l;
+	shared_ptr<Shape> gpu_source; // copy by value (lower detail, recolored) draws VAO of this shape, see gpu_share()
+
+	// GPU-resident mode: after upload v, t, norm, lines and raw_vertexes are dropped,
+	// cpu_restore() gets them back from mesh_source_fn (or regenerates the primitive).
+	bool cpu_released = false;
+	size_t cpu_released_bytes = 0;
+	int gpu_vertex_count = 0;       // v.size()/3 at upload time, rendering doesn't need v itself
+	bool gpu_has_texcoords = false;
+	size_t gpu_bytes = 0;
+	uint64_t gpu_last_used_frame = 0;
+	bool gpu_residency_listed = false; // in Context::resident_shapes, once
+	std::string mesh_source_fn;
+	btScalar mesh_source_scale = 1;
+	int mesh_source_n = -1;         // mesh index inside mesh_source_fn
+	int primitive_detail = 0;
+	size_t cpu_bytes() const;
+	void cpu_release();
+	void cpu_restore();
+	void gpu_share(const shared_ptr<Shape>& src); // after *this = *src, geometry stays uploaded and evicted in src only
 
 	Shape()  { origin.setIdentity(); }
 };
@@ -95,6 +118,7 @@ struct ShapeDetailLevels {
 };
 
 void load_model(const shared_ptr<ShapeDetailLevels>& result, const std::string& fn, btScalar scale, const btTransform& transform);
+void load_model_mesh(Shape* mesh, const std::string& fn, btScalar scale, int mesh_n);
 bool load_collision_shape_from_OFF_files(const shared_ptr<ShapeDetailLevels>& result, const std::string& fn_template, btScalar scale, const btTransform& viz_frame);
 
 } // namespace Household
@@ -0,0 +1,325 @@
+#include "render-glwidget.h"
+#include <QtWidgets/QApplication>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <random>
+
+// Headless benchmark, built by "make bench". Prints JSON to stdout, progress to stderr:
+//
+//   roboschool-bench [--quick] [roboschool_dir] > bench.json
+//
+// roboschool_dir is where mujoco_assets and models_* are, default is directory of executable.
+// Without a display run it as QT_QPA_PLATFORM=offscreen roboschool-bench, same as python.
+// Latencies have the same keys as World.metrics() in python.
+
+using boost::shared_ptr;
+using namespace Household;
+
+namespace Household {
+btScalar SCALE = 1.0;
+}
+
+static const float GRAVITY    = 9.8;
+static const float TIMESTEP   = 0.0165/4; // same as stadium scene
+static const int   FRAME_SKIP = 4;
+
+static int STEPS       = 2000; // per model, without resets
+static int EPISODE     = 1000; // reset after that many steps, as time limit does in gym
+static int RESETS      = 50;
+static int LOADS       = 20;   // each of cold and warm
+static int FRAMES      = 100;  // per modality and resolution
+
+static shared_ptr<World> world;
+static std::string root;
+static std::mt19937 rng(0);
+
+static float uniform(float lo, float hi)
+{
+	return std::uniform_real_distribution<float>(lo, hi)(rng);
+}
+
+static void json_string(const std::string& s)
+{
+	putchar('"');
+	for (unsigned char c: s) {
+		if (c=='"' || c=='\\') printf("\\%c", c);
+		else if (c < 0x20) printf("\\u%04x", c);
+		else putchar(c);
+	}
+	putchar('"');
+}
+
+static void json_latency(const LatencyHistogram& h)
+{
+	printf("{\"count\":%llu,\"total_ms\":%0.3f,\"mean_us\":%0.3f,\"min_us\":%0.3f,\"max_us\":%0.3f,\"p50_us\":%0.3f,\"p90_us\":%0.3f,\"p99_us\":%0.3f}",
+		(unsigned long long) h.count,
+		h.sum_ns/1e6,
+		h.count ? h.sum_ns/1e3/h.count : 0.0,
+		h.count ? h.min_ns/1e3 : 0.0,
+		h.max_ns/1e3,
+		h.percentile_ns(50)/1e3,
+		h.percentile_ns(90)/1e3,
+		h.percentile_ns(99)/1e3);
+}
+
+static void scene_restart()
+{
+	// as StadiumScene.episode_restart() in python
+	world->clean_everything();
+	btTransform tr;
+	tr.setIdentity();
+	world->load_thingy(root + "/models_outdoor/stadium/stadium1.obj", tr, 1.0, 0, 0xFFFFFF, true);
+	world->load_sdf_mjcf(root + "/mujoco_assets/ground_plane.xml", true);
+}
+
+static std::list<shared_ptr<Robot>> mjcf_reset(const std::string& fn)
+{
+	// as MujocoXmlEnv._reset(): scene, model, random joint positions
+	scene_restart();
+	std::list<shared_ptr<Robot>> robots = world->load_sdf_mjcf(fn, true);
+	for (const shared_ptr<Robot>& r: robots) {
+		for (const shared_ptr<Joint>& j: r->joints)
+			j->reset_current_position(uniform(-0.1, +0.1), 0);
+		world->query_body_position(r);
+	}
+	return robots;
+}
+
+static void bench_mjcf(const std::string& name)
+{
+	std::string fn = root + "/mujoco_assets/" + name;
+	LatencyHistogram reset;
+	std::list<shared_ptr<Robot>> robots;
+	for (int i=0; i<RESETS; i++) {
+		QElapsedTimer timer;
+		timer.start();
+		robots = mjcf_reset(fn); // old robots stay alive until new are loaded, as in python
+		reset.record(timer.nsecsElapsed());
+	}
+
+	std::vector<shared_ptr<Joint>> joints;
+	for (const shared_ptr<Robot>& r: robots)
+		for (const shared_ptr<Joint>& j: r->joints)
+			joints.push_back(j);
+
+	LatencyHistogram step;
+	uint64_t total_ns = 0;
+	world->metrics.reset();
+	for (int i=0; i<STEPS; i++) {
+		if (i && i % EPISODE==0) robots = mjcf_reset(fn);
+		QElapsedTimer timer;
+		timer.start();
+		for (const shared_ptr<Joint>& j: joints)
+			j->set_motor_torque(0.75 * j->joint_max_force * uniform(-1, +1)); // as apply_action() with power 0.75
+		world->bullet_step(FRAME_SKIP); // positions and speeds queried inside
+		uint64_t ns = timer.nsecsElapsed();
+		step.record(ns);
+		total_ns += ns;
+	}
+
+	printf("{\"joints\":%i,\"steps_per_sec\":%0.1f,\"physics_steps_per_sec\":%0.1f,\"env_step\":",
+		int(joints.size()),
+		STEPS / (total_ns/1e9),
+		STEPS*FRAME_SKIP / (total_ns/1e9));
+	json_latency(step);
+	for (int m: { METRIC_SUBMIT, METRIC_STEP, METRIC_QUERY }) {
+		printf(",\"%s\":", metric_names[m]);
+		json_latency(world->metrics.hist[m]);
+	}
+	printf(",\"reset\":");
+	json_latency(reset);
+	printf("}");
+}
+
+static void bench_load(const std::string& kind, const std::string& fn)
+{
+	btTransform tr;
+	tr.setIdentity();
+	shared_ptr<Robot> keep_urdf;
+	std::list<shared_ptr<Robot>> keep_mjcf;
+	shared_ptr<Thingy> keep_thingy;
+	auto load = [&]() {
+		if (kind=="urdf") keep_urdf = world->load_urdf(fn, tr, false, false);
+		else if (kind=="mjcf") keep_mjcf = world->load_sdf_mjcf(fn, true);
+		else keep_thingy = world->load_thingy(fn, tr, 1.0, 1.0, 0xFF0000, false);
+	};
+
+	printf("{\"file\":");
+	json_string(fn.substr(root.size() + 1));
+	for (int warm=0; warm<2; warm++) {
+		LatencyHistogram h;
+		for (int i=0; i<LOADS; i++) {
+			world->clean_everything();
+			if (!warm) {
+				// cold: no shapes in klass_cache, everything parsed from files again (disk cache is still warm)
+				keep_urdf.reset();
+				keep_mjcf.clear();
+				keep_thingy.reset();
+				world->klass_cache_clear();
+			}
+			QElapsedTimer timer;
+			timer.start();
+			load();
+			h.record(timer.nsecsElapsed());
+		}
+		printf(warm ? ",\"warm\":" : ",\"cold\":");
+		json_latency(h);
+	}
+	printf("}");
+}
+
+static void bench_render(uint32_t modalities, int w, int h)
+{
+	shared_ptr<Camera> cam(new Camera);
+	cam->camera_name = "bench";
+	cam->camera_res_w = w;
+	cam->camera_res_h = h;
+	cam->camera_aux_w = w/2;
+	cam->camera_aux_h = h/2;
+	// look at robot from (2,-2,1.5), as Camera.move_and_look_at() does
+	btQuaternion pitch(btVector3(1,0,0), M_PI/2 + atan2(1.0 - 1.5, sqrt(8.0)));
+	btQuaternion yaw(btVector3(0,0,1), atan2(2.0, -2.0) - M_PI/2);
+	cam->camera_pose = btTransform(yaw*pitch, btVector3(2*SCALE, -2*SCALE, 1.5*SCALE));
+
+	for (int i=0; i<10; i++)
+		cam->camera_render(world->cx, modalities, false); // shaders, render targets, mesh upload
+	LatencyHistogram lat;
+	uint64_t total_ns = 0;
+	for (int i=0; i<FRAMES; i++) {
+		world->bullet_step(FRAME_SKIP); // something moves, as in real use
+		QElapsedTimer timer;
+		timer.start();
+		cam->camera_render(world->cx, modalities, false);
+		uint64_t ns = timer.nsecsElapsed();
+		lat.record(ns);
+		total_ns += ns;
+	}
+	printf("{\"fps\":%0.1f,\"frame\":", FRAMES / (total_ns/1e9));
+	json_latency(lat);
+	printf("}");
+}
+
+int main(int argc, char *argv[])
+{
+	bool quick = false;
+	for (int c=1; c<argc; c++) {
+		std::string a = argv[c];
+		if (a=="--quick") {
+			quick = true;
+		} else if (a[0]=='-') {
+			fprintf(stderr, "Usage: %s [--quick] [roboschool_dir] > bench.json\n", argv[0]);
+			return 1;
+		} else {
+			root = a;
+		}
+	}
+	if (quick) {
+		STEPS = 200;
+		EPISODE = 100;
+		RESETS = 5;
+		LOADS = 3;
+		FRAMES = 10;
+	}
+
+	world.reset(new World);
+	SimpleRender::opengl_init_before_app(world);
+	QApplication app(argc, argv);
+	SimpleRender::opengl_init(world->cx);
+	world->bullet_init(GRAVITY*SCALE, TIMESTEP);
+	if (root.empty()) root = QCoreApplication::applicationDirPath().toUtf8().constData();
+
+	QStringList xmls = QDir(QString::fromUtf8((root + "/mujoco_assets").c_str())).entryList(QStringList() << "*.xml", QDir::Files, QDir::Name);
+	if (xmls.empty()) {
+		fprintf(stderr, "No MJCF files in '%s/mujoco_assets', give roboschool directory as argument\n", root.c_str());
+		return 1;
+	}
+
+	world->cx->glcx->makeCurrent(world->cx->surf);
+	printf("{\n\"gl_renderer\":");
+	json_string((const char*) glGetString(GL_RENDERER));
+#ifdef USE_SSAO
+	printf(",\n\"ssao\":true");
+#else
+	printf(",\n\"ssao\":false");
+#endif
+	printf(",\n\"timestep\":%0.6f,\n\"frame_skip\":%i", TIMESTEP, FRAME_SKIP);
+
+	printf(",\n\"mjcf\":{");
+	const char* sep = "\n";
+	for (const QString& x: xmls) {
+		std::string name = x.toUtf8().constData();
+		if (name=="ground_plane.xml") continue; // floor of every scene, loaded with each model anyway
+		fprintf(stderr, "step, reset: %s\n", name.c_str());
+		printf("%s", sep);
+		json_string(name);
+		printf(":");
+		try {
+			bench_mjcf(name);
+		} catch (const std::exception& e) {
+			fprintf(stderr, "ERROR: %s\n", e.what());
+			printf("{\"error\":");
+			json_string(e.what());
+			printf("}");
+		}
+		sep = ",\n";
+	}
+	printf("\n}");
+
+	struct {
+		const char* kind;
+		const char* fn;
+	} loads[] = {
+		{ "urdf",   "/models_robot/atlas_description/urdf/atlas_v4_with_multisense.urdf" },
+		{ "mjcf",   "/mujoco_assets/humanoid_symmetric.xml" },
+		{ "thingy", "/models_outdoor/stadium/stadium1.obj" },
+	};
+	printf(",\n\"load\":{");
+	sep = "\n";
+	for (auto l: loads) {
+		fprintf(stderr, "load: %s\n", l.fn);
+		printf("%s\"%s\":", sep, l.kind);
+		try {
+			bench_load(l.kind, root + l.fn);
+		} catch (const std::exception& e) {
+			fprintf(stderr, "ERROR: %s\n", e.what());
+			printf("{\"error\":");
+			json_string(e.what());
+			printf("}");
+		}
+		sep = ",\n";
+	}
+	printf("\n}");
+
+	struct {
+		const char* name;
+		uint32_t modalities;
+	} modalities[] = {
+		{ "rgb",        CAMERA_RGB },
+		{ "depth",      CAMERA_DEPTH },
+		{ "labeling",   CAMERA_LABELING },
+		{ "pointcloud", CAMERA_POINTCLOUD },
+		{ "instances",  CAMERA_INSTANCES },
+		{ "all",        CAMERA_RGB|CAMERA_DEPTH|CAMERA_LABELING|CAMERA_POINTCLOUD|CAMERA_INSTANCES },
+	};
+	int resolutions[][2] = { { 64, 64 }, { 192, 128 }, { 640, 480 } };
+	std::list<shared_ptr<Robot>> robots = mjcf_reset(root + "/mujoco_assets/humanoid_symmetric.xml");
+	printf(",\n\"render\":{");
+	sep = "\n";
+	for (auto m: modalities) {
+		fprintf(stderr, "render: %s\n", m.name);
+		printf("%s\"%s\":{", sep, m.name);
+		const char* sep2 = "";
+		for (auto r: resolutions) {
+			printf("%s\"%ix%i\":", sep2, r[0], r[1]);
+			bench_render(m.modalities, r[0], r[1]);
+			sep2 = ",";
+		}
+		printf("}");
+		sep = ",\n";
+	}
+	printf("\n}\n}\n");
+
+	robots.clear();
+	world.reset();
+	return 0;
+}
@@ -0,0 +1,126 @@
+#include "dynamics.h"
+#include <stdexcept>
+#include <string>
+
+namespace Household {
+
+int robot_dofs(const Robot* robot)
+{
+	int n = 0;
+	for (const shared_ptr<Joint>& j: robot->joints)
+		if (j) n++;
+	return n;
+}
+
+// bullet reads one value per link (b3GetNumJoints), dofs first
+struct DynamicsState {
+	int dofs;
+	std::vector<double> q, qdot, qddot;
+	DynamicsState(const Robot* robot):
+		dofs(0),
+		q(robot->joints.size() + 1, 0.0),
+		qdot(robot->joints.size() + 1, 0.0),
+		qddot(robot->joints.size() + 1, 0.0)
+	{
+		for (const shared_ptr<Joint>& j: robot->joints) {
+			if (!j) continue;
+			q[dofs] = j->joint_current_position;
+			qdot[dofs] = j->joint_current_speed;
+			dofs++;
+		}
+	}
+};
+
+// Returns number of columns, 3 x columns row major each, floating base adds 6 columns before joints
+static int bullet_jacobian(World* world, Robot* robot, const DynamicsState& s, int link_n, std::vector<double>* jl, std::vector<double>* ja)
+{
+	double local_position[3] = { 0, 0, 0 };
+	b3SharedMemoryCommandHandle cmd = b3CalculateJacobianCommandInit(world->client, robot->bullet_handle, link_n, local_position, s.q.data(), s.qdot.data(), s.qddot.data());
+	b3SharedMemoryStatusHandle status = b3SubmitClientCommandAndWaitStatus(world->client, cmd);
+	if (b3GetStatusType(status) != CMD_CALCULATED_JACOBIAN_COMPLETED)
+		throw std::runtime_error("jacobian failed for '" + robot->original_urdf_name + "' link " + std::to_string(link_n));
+	int cols;
+	jl->resize(3*(robot->joints.size() + 6));
+	ja->resize(jl->size());
+	b3GetStatusJacobian(status, &cols, jl->data(), ja->data());
+	if (cols != s.dofs && cols != s.dofs + 6)
+		throw std::runtime_error("robot '" + robot->original_urdf_name + "' has " + std::to_string(cols) + " dofs in bullet, " +
+			std::to_string(s.dofs) + " joints, only revolute and prismatic joints are supported");
+	return cols;
+}
+
+static bool floating_base(World* world, Robot* robot, const DynamicsState& s)
+{
+	if (robot->dynamics_base_dofs == -1) {
+		std::vector<double> jl, ja;
+		robot->dynamics_base_dofs = bullet_jacobian(world, robot, s, -1, &jl, &ja) - s.dofs;
+	}
+	return robot->dynamics_base_dofs != 0;
+}
+
+static void inverse_dynamics(World* world, Robot* robot, const DynamicsState& s, const std::vector<double>& qdot, double* tau)
+{
+	b3SharedMemoryCommandHandle cmd = b3CalculateInverseDynamicsCommandInit(world->client, robot->bullet_handle, s.q.data(), qdot.data(), s.qddot.data());
+	b3SharedMemoryStatusHandle status = b3SubmitClientCommandAndWaitStatus(world->client, cmd);
+	if (b3GetStatusType(status) != CMD_CALCULATED_INVERSE_DYNAMICS_COMPLETED)
+		throw std::runtime_error("inverse dynamics failed for '" + robot->original_urdf_name + "'");
+	int body, dofs;
+	b3GetStatusInverseDynamicsJointForces(status, &body, &dofs, 0);
+	if (dofs != s.dofs)
+		throw std::runtime_error("robot '" + robot->original_urdf_name + "' has " + std::to_string(dofs) + " dofs in bullet, " +
+			std::to_string(s.dofs) + " joints, only revolute and prismatic joints are supported");
+	b3GetStatusInverseDynamicsJointForces(status, &body, &dofs, tau);
+}
+
+void robot_inverse_dynamics(World* world, Robot* robot, const float* qddot, float* tau)
+{
+	TRACE_SPAN("inverse_dynamics");
+	DynamicsState s(robot);
+	if (floating_base(world, robot, s))
+		throw std::runtime_error("inverse_dynamics(): '" + robot->original_urdf_name + "' has floating base, bullet puts it at origin with gravity along world z, "
+			"torques would be wrong for tilted base; mass_matrices() and jacobians() work for it");
+	for (int i=0; i<s.dofs; i++) s.qddot[i] = qddot[i];
+	std::vector<double> t(s.dofs);
+	inverse_dynamics(world, robot, s, s.qdot, t.data());
+	for (int i=0; i<s.dofs; i++) tau[i] = t[i];
+}
+
+void robot_mass_matrix(World* world, Robot* robot, float* m)
+{
+	TRACE_SPAN("mass_matrix");
+	DynamicsState s(robot);
+	int n = s.dofs;
+	// Joint block of M doesn't depend on base pose, so floating base that bullet puts at origin gives the same numbers
+	std::vector<double> zero(s.qdot.size(), 0.0); // no coriolis, bias is gravity only and cancels out
+	std::vector<double> bias(n), col(n);
+	inverse_dynamics(world, robot, s, zero, bias.data());
+	for (int c=0; c<n; c++) {
+		s.qddot[c] = 1;
+		inverse_dynamics(world, robot, s, zero, col.data());
+		s.qddot[c] = 0;
+		for (int r=0; r<n; r++) m[r*n + c] = col[r] - bias[r];
+	}
+}
+
+void robot_jacobian(World* world, Robot* robot, int link_n, float* lin, float* ang)
+{
+	TRACE_SPAN("jacobian");
+	DynamicsState s(robot);
+	int n = s.dofs;
+	std::vector<double> jl, ja;
+	int cols = bullet_jacobian(world, robot, s, link_n, &jl, &ja);
+	int base = cols - n; // floating base columns go first, not part of result
+
+	// bullet gives it in base frame
+	const btMatrix3x3& basis = robot->root_part->bullet_position.getBasis();
+	for (int c=0; c<n; c++) {
+		btVector3 l = basis * btVector3(jl[0*cols + base + c], jl[1*cols + base + c], jl[2*cols + base + c]);
+		btVector3 a = basis * btVector3(ja[0*cols + base + c], ja[1*cols + base + c], ja[2*cols + base + c]);
+		for (int r=0; r<3; r++) {
+			lin[r*n + c] = l[r] / SCALE;
+			ang[r*n + c] = a[r];
+		}
+	}
+}
+
+}
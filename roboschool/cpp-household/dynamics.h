@@ -0,0 +1,25 @@
+#pragma once
+#include "household.h"
+
+namespace Household {
+
+// Joint space kinematics and dynamics of a robot, computed by bullet inverse dynamics (MultiBodyTree
+// from BulletInverseDynamics) inside the physics server, no copy of the model in python.
+//
+// Dofs are robot->joints that are not null, in that order, same as Robot.joints() in python. State is
+// joint_current_position and joint_current_speed of the last query, as step() leaves it. Base of the robot
+// is held where it is, floating base doesn't add dofs. Bullet puts floating base at origin, so inverse dynamics
+// refuses it (gravity would point wrong way), mass matrix and jacobians don't depend on that.
+
+int robot_dofs(const Robot* robot);
+
+// tau = M(q)*qddot + C(q, qdot) + G(q), dofs values in qddot and tau, fixed base only
+void robot_inverse_dynamics(World* world, Robot* robot, const float* qddot, float* tau);
+
+// M(q), dofs*dofs row major. Column j is inverse dynamics at unit acceleration of joint j, minus bias at zero acceleration.
+void robot_mass_matrix(World* world, Robot* robot, float* m);
+
+// Center of mass of the link link_n (-1 base) moves with lin*qdot, rotates with ang*qdot. 3*dofs row major each, world frame.
+void robot_jacobian(World* world, Robot* robot, int link_n, float* lin, float* ang);
+
+}
@@ -0,0 +1,24 @@
+#version 330
+//#line 3 "hud_plot.frag.glsl"
+
+uniform sampler2D history; // ring of samples: columns are time, rows are channels
+uniform int channel;
+uniform int head;          // column of oldest sample
+
+in vec2 plotCoord;
+
+out vec4 out_Color;
+
+void main()
+{
+    int len = textureSize(history, 0).x;
+    int col = (head + int(plotCoord.x*len)) % len;
+    float v = clamp(texelFetch(history, ivec2(col, channel), 0).r*0.5, -1.0, 1.0);
+    float y = 1.0 - 2.0*plotCoord.y;
+    if (v >= 0.0 && y >= 0.0 && y <= v)
+        out_Color = vec4(0.5, 1.0, 0.5, 1.0);
+    else if (v < 0.0 && y < 0.0 && y >= v)
+        out_Color = vec4(1.0, 0.5, 0.5, 1.0);
+    else
+        out_Color = vec4(0.0, 0.0, 0.0, 100.0/255.0);
+}
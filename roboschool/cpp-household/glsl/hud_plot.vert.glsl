@@ -0,0 +1,21 @@
+#version 330
+//#line 3 "hud_plot.vert.glsl"
+
+uniform vec4 xywh;
+
+layout(location=0) in highp   vec4 input_vertex;
+
+out vec2 plotCoord;
+
+void main()
+{
+    float x = xywh.x;
+    float y = xywh.y;
+    float w = xywh.z;
+    float h = xywh.w;
+    gl_Position = vec4(
+        x + input_vertex.x*w,
+        -y - input_vertex.y*h,
+        0, 1.0);
+    plotCoord = input_vertex.xy; // (0,0) top left of plot
+}
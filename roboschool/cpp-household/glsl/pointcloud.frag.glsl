@@ -0,0 +1,33 @@
+//#line 2 "pointcloud.frag.glsl"
+// no #version here, to insert #define's in C++ code
+
+// Organized point cloud: one point per (1 << shift) block of camera render, taken at block center.
+// Output rows go top to bottom, same as camera_depth. xyz in camera frame (x right, y up,
+// looking along -z) or world frame, depending on to_output. w is label, or -1 if nothing was hit.
+
+uniform sampler2D texLinearDepth; // from ssao_depthlinearize.frag.glsl
+uniform sampler2D texDepth;       // depth buffer itself, to tell background apart
+uniform sampler2D texLabels;      // metaclass in blue, if labeling was the last pass
+uniform vec4 projInfo;            // same as in ssao_hbao.frag.glsl
+uniform mat4 to_output;
+uniform int shift;
+uniform int have_labels;
+
+out vec4 out_Color;
+
+void main()
+{
+  ivec2 full_size = textureSize(texDepth, 0);
+  int block = 1 << shift;
+  ivec2 o = ivec2(gl_FragCoord.xy);
+  ivec2 p = ivec2(o.x, (full_size.y >> shift) - 1 - o.y)*block + ivec2(block/2);
+  if (texelFetch(texDepth, p, 0).x == 1.0) {
+    out_Color = vec4(0, 0, 0, -1);
+    return;
+  }
+  float z = texelFetch(texLinearDepth, p, 0).x;
+  vec2 uv = (vec2(p) + 0.5) / vec2(full_size);
+  vec3 view = vec3((uv*projInfo.xy + projInfo.zw)*z, -z);
+  float label = have_labels != 0 ? floor(texelFetch(texLabels, p, 0).b*255.0 + 0.5) : 0.0;
+  out_Color = vec4((to_output*vec4(view, 1)).xyz, label);
+}
@@ -4,7 +4,6 @@
 
 
 
-uniform bool enable_texture;
 uniform sampler2D texture_id;
 
 in Interpolants {
@@ -13,6 +12,8 @@ in Interpolants {
     flat vec4 color;
     vec3 N;
     vec2 texcoord;
+    flat int use_texture;
+    flat int flat_color;
 } IN;
 
 layout(location=0,index=0) out vec4 out_Color;
@@ -22,13 +23,15 @@ void main()
 {
     vec4 c = IN.color;
     //vec3 n1 = normalize(IN.normal);
-    if (enable_texture) {
+    if (IN.use_texture != 0) {
         c = texture(texture_id, IN.texcoord);
     }
     //out_Color   = (0.3 + 0.72*max(0.5, dot(IN.N, vec3(0,0,-1))) + 0.72*max(0.2, dot(vec3(n1), vec3(0,1,0))) ) * c;
     //out_Color   = (0.3 + 0.72*max(0.5, dot(IN.N, vec3(0,0,-1))) ) * c;
     //out_Color   = (0.3 + 0.72*max(0.2, dot(vec3(n1), vec3(0,1,0))) ) * c;
-    if (false) {
+    if (IN.flat_color != 0) {
+        out_Color = c; // exact value, labels are read back bitwise
+    } else if (false) {
         out_Color.r = IN.N[0];
         out_Color.g = IN.N[1];
         out_Color.b = IN.N[2];
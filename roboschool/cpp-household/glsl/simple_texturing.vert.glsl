@@ -6,6 +6,20 @@ uniform highp mat4 input_matrix_modelview_inverse_transpose;
 uniform highp vec4 uni_color;
 uniform bool enable_texture;
 
+// Objects: per draw data is in uniform buffer, filled once per frame, see Context::draw_packets
+// Rulers and other simple things: draw_index = -1, uniforms above are used
+struct DrawData {
+    mat4 modelview;
+    mat4 modelview_inverse_transpose;
+    vec4 color;
+    ivec4 flags; // x: enable_texture, y: flat color without shading (labels)
+};
+const int DRAW_PACKETS_PER_BLOCK = 64; // keep in sync with render-simple.h
+layout(std140) uniform DrawPackets {
+    DrawData draws[DRAW_PACKETS_PER_BLOCK];
+};
+uniform int draw_index;
+
 layout(location=0) in highp   vec4 input_vertex;
 layout(location=1) in mediump vec4 input_normal;
 layout(location=2) in mediump vec2 input_texcoord;
@@ -16,18 +30,33 @@ out Interpolants {
     flat vec4 color;
     vec3 N;
     vec2 texcoord;
+    flat int use_texture;
+    flat int flat_color;
 } OUT;
 
 void main(void)
 {
-    //mat4 t = input_matrix_modelview_inverse_transpose;
-    OUT.N = vec3( normalize(mat3(input_matrix_modelview_inverse_transpose) * vec3(input_normal)) );
-    gl_Position = input_matrix_modelview * input_vertex;
+    mat4 m  = input_matrix_modelview;
+    mat4 mt = input_matrix_modelview_inverse_transpose;
+    vec4 color = uni_color;
+    bool tex = enable_texture;
+    int flat_color = 0;
+    if (draw_index >= 0) {
+        m  = draws[draw_index].modelview;
+        mt = draws[draw_index].modelview_inverse_transpose;
+        color = draws[draw_index].color;
+        tex = draws[draw_index].flags.x != 0;
+        flat_color = draws[draw_index].flags.y;
+    }
+    OUT.N = vec3( normalize(mat3(mt) * vec3(input_normal)) );
+    gl_Position = m * input_vertex;
     //OUT.pos = vec3(input_vertex);
     //vec3(input_vertex.x, input_vertex.y, input_vertex.z);
     OUT.normal = vec3(input_normal);
-    OUT.color = uni_color;
-    if (enable_texture) {
+    OUT.color = color;
+    OUT.use_texture = tex ? 1 : 0;
+    OUT.flat_color = flat_color;
+    if (tex) {
         OUT.texcoord = vec2(input_texcoord);
     }
 }
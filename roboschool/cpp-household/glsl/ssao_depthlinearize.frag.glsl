@@ -6,6 +6,7 @@
 #endif
 
 uniform vec4 clipInfo; // z_n * z_f,  z_n - z_f,  z_f, perspective = 1 : 0
+uniform int downsample; // 1 full resolution, 2 half
 
 //#if DEPTHLINEARIZE_MSAA
 //layout(location=1) uniform int sampleIndex;
@@ -38,7 +39,7 @@ void main() {
 //#if DEPTHLINEARIZE_MSAA
 //  float depth = texelFetch(inputTexture, ivec2(gl_FragCoord.xy), sampleIndex).x;
 //#else
-    float depth = texelFetch(inputTexture, ivec2(gl_FragCoord.xy), 0).x;
+    float depth = texelFetch(inputTexture, ivec2(gl_FragCoord.xy)*downsample, 0).x;
 //#endif
     out_Color = vec4(reconstructCSZ(depth, clipInfo), 0,0,1);
 }
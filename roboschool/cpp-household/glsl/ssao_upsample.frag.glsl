@@ -0,0 +1,39 @@
+//#line 2 "ssao_upsample.frag.glsl"
+// no #version here, to insert #define's in C++ code
+
+// Applies AO computed at lower resolution: each pixel mixes 4 nearest AO texels, weighted
+// bilinearly and by how close their depth is to this pixel's depth, so AO doesn't leak across edges.
+
+uniform sampler2D texAO;         // AO, 1/downsample resolution
+uniform sampler2D texLowDepth;   // linear depth at AO resolution
+uniform sampler2D texFullDepth;  // linear depth at full resolution
+uniform int downsample;
+
+out vec4 out_Color;
+
+void main()
+{
+  ivec2 full = ivec2(gl_FragCoord.xy);
+  if (downsample == 1) {
+    out_Color = vec4(texelFetch(texAO, full, 0).x);
+    return;
+  }
+  float z = texelFetch(texFullDepth, full, 0).x;
+  ivec2 low_size = textureSize(texAO, 0);
+  vec2 low = gl_FragCoord.xy / float(downsample) - 0.5;
+  ivec2 base = ivec2(floor(low));
+  vec2 f = fract(low);
+  float ao_total = 0.0;
+  float w_total = 0.0;
+  for (int j=0; j<2; j++) {
+    for (int i=0; i<2; i++) {
+      ivec2 p = clamp(base + ivec2(i,j), ivec2(0), low_size - 1);
+      float bilinear = (i==1 ? f.x : 1.0-f.x) * (j==1 ? f.y : 1.0-f.y);
+      float dz = abs(texelFetch(texLowDepth, p, 0).x - z) / max(abs(z), 0.001);
+      float w = (bilinear + 0.001) / (0.001 + dz);
+      ao_total += w*texelFetch(texAO, p, 0).x;
+      w_total  += w;
+    }
+  }
+  out_Color = vec4(ao_total / w_total);
+}
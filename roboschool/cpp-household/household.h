@@ -1,5 +1,7 @@
 #pragma once
 #include "assets.h"
+#include "metrics.h"
+#include "trace.h"
 #include <bullet/PhysicsClientC_API.h>
 #include <boost/weak_ptr.hpp>
 #include <boost/enable_shared_from_this.hpp>
@@ -23,6 +25,8 @@ enum {
 	METACLASS_ITEM      = 0x20,
 };
 
+const int INSTANCE_ID_MAX = 0xFFFFFF; // rendered as 24 bit rgb, see ContextViewport::_collect_single_object
+
 struct ThingyClass {
 	std::string class_name;
 	uint8_t metaclass = 0;
@@ -56,6 +60,7 @@ struct Thingy {
 	btTransform bullet_link_position;
 	btTransform bullet_local_inertial_frame;
 	bool in_drawlist = false;
+	uint32_t instance_id = 0; // 1..INSTANCE_ID_MAX, assigned with drawlist, rendered by CAMERA_INSTANCES, World.instance_table() in python
 	btVector3   bullet_speed;
 	btVector3   bullet_angular_speed;
 	bool bullet_queried_at_least_once = false;
@@ -85,6 +90,9 @@ struct Joint {
 	bool torque_need_repeat = false;
 	float torque_repeat_val = 0;
 
+	int motor_mode = -1; // CONTROL_MODE_VELOCITY or CONTROL_MODE_POSITION_VELOCITY_PD of last command, -1 none; World::state_copy_from() repeats it
+	float motor_target = 0, motor_kp = 0, motor_kd = 0, motor_max_force = 0;
+
 	void joint_current_relative_position(float* pos, float* speed);
 	void reset_current_position(float pos, float vel);
 
@@ -99,6 +107,16 @@ struct Joint {
 	void activate();
 };
 
+enum {
+	CAMERA_RGB      = 0x01,
+	CAMERA_DEPTH    = 0x02,
+	CAMERA_LABELING = 0x04,
+	CAMERA_POINTCLOUD = 0x08,
+	CAMERA_INSTANCES  = 0x10,
+};
+
+enum { SSAO_OFF, SSAO_HALF, SSAO_FULL, SSAO_REUSED }; // SSAO quality tiers, SSAO_REUSED is only a stats bucket, for temporal frames
+
 struct Camera {
 	std::string camera_name;
 	std::string score;
@@ -113,18 +131,53 @@ struct Camera {
 	float camera_near  = 0.001;
 	float camera_far   = 100;
 	float camera_fps   = 60;
+	uint32_t camera_modalities = CAMERA_RGB; // always rendered, render() arguments can add more
+	int   camera_ssao_quality = SSAO_FULL; // SSAO_OFF, SSAO_HALF, SSAO_FULL
+	bool  camera_ssao_temporal = false;
 	std::string camera_rgb;
 	std::string camera_depth;
 	std::string camera_depth_mask;
 	std::string camera_labeling;
 	std::string camera_labeling_mask;
+	std::string camera_instances;      // camera_aux_w*camera_aux_h of uint32 Thingy::instance_id, 0 nothing hit
+	std::string camera_pointcloud;     // camera_aux_w*camera_aux_h of (x, y, z, label), label -1 where nothing hit
+	bool camera_pointcloud_world = false; // world frame, otherwise camera frame (x right, y up, looks along -z)
+	bool camera_pointcloud_half  = false; // float16, otherwise float32
 
 	shared_ptr<SimpleRender::ContextViewport> viewport;
-	void camera_render(const shared_ptr<SimpleRender::Context>& cx, bool render_depth, bool render_labeling, bool print_timing);
+	void camera_render(const shared_ptr<SimpleRender::Context>& cx, uint32_t modalities, bool print_timing); // only passes needed for CAMERA_* in modalities
+
+	// Render scheduler, see World::camera_render_scheduler
+	double render_ts = -1;      // world time of frame in camera_rgb etc, -1 nothing cached
+	uint32_t render_had_modalities = 0;
+	std::vector<btTransform> render_scene; // camera pose and drawlist positions at that frame
+	std::vector<float> render_params;      // resolution, fov, near/far, ssao and pointcloud settings at that frame
+	int render_hits = 0;
+	int render_misses = 0;
+	bool camera_render_cached(World* world, uint32_t modalities);
+
+	shared_ptr<SimpleRender::Buffer> readback_pbo; // World::cameras_render_rgb()
+	size_t readback_pbo_bytes = 0;
+	std::vector<uint8_t> readback_tmp; // camera_render() scratch, on heap: 640x480 with oversampling doesn't fit on stack
+	std::vector<float> readback_ftmp, readback_acc, readback_sqr;
+	std::vector<uint8_t> readback_bits; // labeling subpixel counts
+	std::vector<uint16_t> readback_rgb_acc;
+
+	shared_ptr<SimpleRender::VideoRecorder> recorder;
+	double recorder_last_ts = -1; // world time, frames are recorded every 1/camera_fps
 
 	Camera()  { camera_pose.setIdentity(); }
 };
 
+// Joint driven by Robot::pd_joints, torque recomputed from joint state at every physics substep
+struct PdJoint {
+	shared_ptr<Joint> joint;
+	float kp, kd, max_torque;
+	float target_pos = 0;
+	float target_speed = 0;
+	float last_torque = 0; // at last substep, after clipping
+};
+
 struct Robot {
 	shared_ptr<Thingy> root_part;
 	int bullet_handle;
@@ -132,9 +185,48 @@ struct Robot {
 	std::vector<shared_ptr<Thingy>> robot_parts;
 	std::vector<shared_ptr<Joint>> joints;
 	std::vector<shared_ptr<Camera>> cameras;
+
+	// torque = kp*(target_pos - pos) + kd*(target_speed - speed), clipped to max_torque. If any robot
+	// has PD joints, World::bullet_step() calls bullet once per substep to recompute torques in between.
+	std::vector<PdJoint> pd_joints;
+	void pd_joint_add(const shared_ptr<Joint>& j, float kp, float kd, float max_torque);
+	void pd_set_targets(const float* pos, const float* speed); // pd_joints.size() values each, speed can be 0
+	void pd_clear();
+	int dynamics_base_dofs = -1; // 0 fixed base, 6 floating, -1 not asked bullet yet, see dynamics.cpp
 	//void replace_texture(const std::string& material_name, const std::string& new_jpeg_png);
 };
 
+// World::memory_report(), World.memory_report() in python
+struct MemoryReport {
+	size_t cpu_mesh = 0;          // visual shapes of classes in klass_cache
+	size_t cpu_mesh_released = 0; // dropped in GPU resident mode, not in cpu_mesh
+	size_t cpu_camera = 0;        // last images and readback scratch of free and robot cameras
+	size_t cpu_lists = 0;         // klass_cache, drawlist, robotlist entries
+	size_t physics = 0;           // collision shapes, Thingy/Robot/Joint mirrors of bullet objects
+	size_t gpu_buffers = 0;       // vertex buffers, uniform buffers, readback pixel buffers
+	size_t gpu_textures = 0;      // loaded from files, SSAO noise
+	size_t gpu_framebuffers = 0;  // render target pool, per camera AO, point cloud and HUD textures
+	int klasses = 0;
+	int shapes = 0;
+	int thingies = 0;
+	int robots = 0;
+	int joints = 0;
+	int cameras = 0;
+	int bullet_bodies = 0;
+};
+
+// Bodies loaded into bullet since clean_everything(), World::clone() loads the same into new world
+struct WorldLoad {
+	enum { URDF, SDF, MJCF };
+	int kind;
+	std::string fn;
+	btTransform tr;
+	bool fixed_base = false;
+	bool self_collision = false;
+	std::vector<int> bullet_handles;
+	std::vector<weak_ptr<Robot>> robots;
+};
+
 struct World: boost::enable_shared_from_this<World> {
 	b3PhysicsClientHandle client;
 	boost::shared_ptr<App> app_ref; // Keep application alive, while some worlds exist. If no worlds exist then new world gets created, probably will crash :(
@@ -150,17 +242,31 @@ struct World: boost::enable_shared_from_this<World> {
 	std::map<std::string, weak_ptr<ThingyClass>> klass_cache;
 	shared_ptr<ThingyClass> klass_cache_find_or_create(const std::string& kname);
 	void klass_cache_clear();
+	bool gpu_resident_meshes = false; // drop CPU copies of shapes once uploaded, see Shape::cpu_release()
+	void mesh_memory(size_t* cpu_bytes, size_t* gpu_bytes, size_t* cpu_released_bytes);
+	void memory_report(MemoryReport* r); // walks everything once, fine to call each episode
+	size_t residency_budget_gpu = 0; // bytes, 0 is unlimited, see Context::residency_enforce()
+	size_t residency_budget_cpu = 0;
 
 	std::vector<weak_ptr<Robot>> robotlist;
 	std::map<int, weak_ptr<Robot>> bullet_handle_to_robot;
 
 	std::vector<weak_ptr<Thingy>> drawlist;
 	void thingy_add_to_drawlist(const shared_ptr<Thingy>& t);
+	uint32_t instance_id_last = 0; // reset by clean_everything()
 	double ts = 0;
 
 	shared_ptr<SimpleRender::Context> cx;
+	bool camera_render_scheduler = false; // Camera.render() keeps last frame until 1/camera_fps passed and something moved
+	std::list<weak_ptr<Camera>> recording_cameras;
+	std::list<weak_ptr<Camera>> cameras; // free floating, for memory_report()
+	void cameras_render_rgb(const std::vector<shared_ptr<Camera>>& cams, const std::vector<uint8_t*>& dst); // rgb of many cameras in one go, written to dst[i] (camera_res_w*camera_res_h*3 each)
+	void recording_tick();
 
 	void bullet_init(float gravity, float timestep);
+	std::vector<WorldLoad> loads;
+	shared_ptr<World> clone(std::vector<shared_ptr<Robot>>* robots); // new bullet client, same bodies and state, robots in robotlist order
+	void state_copy_from(World* src); // src must have same loads, as clone() or same load calls give
 	void bullet_step(int skip_frames);
 	void clean_everything();
 	void query_positions();
@@ -168,6 +274,10 @@ struct World: boost::enable_shared_from_this<World> {
 
 	std::list<shared_ptr<Household::Thingy>> bullet_contact_list(const shared_ptr<Thingy>& t);
 	double performance_bullet_ms;
+	Metrics metrics;
+	int bullet_trace_log = -1; // bullet own profile timings, see World.start_trace()
+	void bullet_trace_start(const std::string& fn);
+	void bullet_trace_stop();
 
 	shared_ptr<Thingy> load_thingy(const std::string& the_filename, const btTransform& tr, float scale, float mass, uint32_t color, bool decoration_only);
 	shared_ptr<Robot> load_urdf(const std::string& fn, const btTransform& tr, bool fixed_base, bool self_collision);
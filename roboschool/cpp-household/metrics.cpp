@@ -0,0 +1,82 @@
+#include "metrics.h"
+#include <string.h>
+
+namespace Household {
+
+const char* metric_names[METRIC_COUNT] = {
+	"submit",
+	"step",
+	"query",
+	"contacts",
+	"paint_rgb",
+	"paint_depth",
+	"paint_instances",
+	"paint_labeling",
+	"paint_pointcloud",
+	"readback",
+	"downsample",
+};
+
+const char* counter_names[COUNTER_COUNT] = {
+	"joint_commands",
+	"contact_points",
+	"readback_bytes",
+};
+
+void LatencyHistogram::reset()
+{
+	count = 0;
+	sum_ns = 0;
+	min_ns = UINT64_MAX;
+	max_ns = 0;
+	memset(buckets, 0, sizeof(buckets));
+}
+
+int LatencyHistogram::bucket(uint64_t ns)
+{
+	if (ns < SUB) return int(ns);
+	int msb = 63 - __builtin_clzll(ns);
+	if (msb >= MAX_BITS) return BUCKETS-1;
+	return (msb - SUB_BITS + 1)*SUB + int((ns >> (msb - SUB_BITS)) & (SUB-1));
+}
+
+uint64_t LatencyHistogram::bucket_top(int b)
+{
+	if (b < SUB) return b;
+	int msb = b/SUB - 1 + SUB_BITS;
+	uint64_t width = uint64_t(1) << (msb - SUB_BITS);
+	return (uint64_t(1) << msb) + (b % SUB)*width + width - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+	count++;
+	sum_ns += ns;
+	if (ns < min_ns) min_ns = ns;
+	if (ns > max_ns) max_ns = ns;
+	buckets[bucket(ns)]++;
+}
+
+uint64_t LatencyHistogram::percentile_ns(double p) const
+{
+	if (count==0) return 0;
+	uint64_t want = uint64_t(p/100.0*count + 0.5);
+	if (want < 1) want = 1;
+	uint64_t seen = 0;
+	for (int b=0; b<BUCKETS; b++) {
+		seen += buckets[b];
+		if (seen >= want) {
+			uint64_t top = bucket_top(b);
+			return top < max_ns ? top : max_ns;
+		}
+	}
+	return max_ns;
+}
+
+void Metrics::reset()
+{
+	for (LatencyHistogram& h: hist) h.reset();
+	memset(counters, 0, sizeof(counters));
+}
+
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+#include <chrono>
+
+namespace Household {
+
+// Per World performance counters, World::metrics, World.metrics() in python.
+// Paint times are CPU side (GL is asynchronous), GPU wait shows up in readback.
+
+enum {
+	METRIC_SUBMIT,          // joint commands repeated before step
+	METRIC_STEP,            // bullet step simulation
+	METRIC_QUERY,           // positions and speeds after step
+	METRIC_CONTACTS,        // bullet_contact_list()
+	METRIC_PAINT_RGB,       // camera passes
+	METRIC_PAINT_DEPTH,
+	METRIC_PAINT_INSTANCES,
+	METRIC_PAINT_LABELING,
+	METRIC_PAINT_POINTCLOUD,
+	METRIC_READBACK,        // glReadPixels(), pixel buffer maps
+	METRIC_DOWNSAMPLE,      // oversampled pixels to camera resolution
+	METRIC_COUNT
+};
+
+enum {
+	COUNTER_JOINT_COMMANDS, // commands sent to bullet for joints
+	COUNTER_CONTACT_POINTS,
+	COUNTER_READBACK_BYTES,
+	COUNTER_COUNT
+};
+
+extern const char* metric_names[METRIC_COUNT];
+extern const char* counter_names[COUNTER_COUNT];
+
+// Log-linear histogram of nanoseconds, HDR style: 16 linear buckets per power of two, so any percentile
+// is within 1/16 of true value. Fixed size, recording is a few instructions and no allocation.
+struct LatencyHistogram {
+	enum { SUB_BITS = 4, SUB = 1 << SUB_BITS, MAX_BITS = 44, BUCKETS = (MAX_BITS - SUB_BITS + 1)*SUB };
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint32_t buckets[BUCKETS];
+
+	LatencyHistogram()  { reset(); }
+	void reset();
+	void record(uint64_t ns);
+	uint64_t percentile_ns(double p) const; // p in 0..100
+
+	static int bucket(uint64_t ns);
+	static uint64_t bucket_top(int b); // largest value that goes into bucket b
+};
+
+struct Metrics {
+	LatencyHistogram hist[METRIC_COUNT];
+	uint64_t counters[COUNTER_COUNT];
+
+	Metrics()  { reset(); }
+	void reset();
+	void record(int metric, uint64_t ns)  { hist[metric].record(ns); }
+	void count(int counter, uint64_t n)   { counters[counter] += n; }
+};
+
+// Records time until stop() or end of scope, does nothing if metrics is 0
+struct MetricsTimer {
+	Metrics* m;
+	int metric;
+	std::chrono::steady_clock::time_point t0;
+	MetricsTimer(Metrics* m, int metric): m(m), metric(metric)  { if (m) t0 = std::chrono::steady_clock::now(); }
+	~MetricsTimer()  { stop(); }
+	void stop()
+	{
+		if (!m) return;
+		m->record(metric, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+		m = 0;
+	}
+};
+
+}
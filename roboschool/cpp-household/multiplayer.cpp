@@ -0,0 +1,243 @@
+#include "multiplayer.h"
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+namespace Household {
+
+const uint32_t SHM_MAGIC = 0x52534D32; // "RSM2"
+const int SHM_SPIN = 2000; // polls before sleeping, a few microseconds: other side usually answers faster than futex wakes up
+
+static size_t align64(size_t x)  { return (x + 63) & ~size_t(63); }
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+// Returns true when word is not old anymore. Waiter announces itself in waiters before sleeping,
+// shm_wake() checks it after changing word, both sequentially consistent, so no wakeup is lost.
+static bool shm_wait(std::atomic<uint32_t>& word, uint32_t old, std::atomic<uint32_t>& waiters, int timeout_ms)
+{
+	static const int spin = std::thread::hardware_concurrency() > 1 ? SHM_SPIN : 0; // on single cpu other side can't answer while we spin
+	for (int i=0; i<spin; i++) {
+		if (word.load(std::memory_order_acquire) != old) return true;
+		cpu_relax();
+	}
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while (1) {
+		int left_us = 1000;
+		if (timeout_ms >= 0) {
+			left_us = (int) std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (left_us <= 0) return word.load(std::memory_order_acquire) != old;
+		}
+		waiters.fetch_add(1);
+		if (word.load() == old) {
+#ifdef __linux__
+			struct timespec ts;
+			ts.tv_sec  = left_us / 1000000;
+			ts.tv_nsec = (left_us % 1000000) * 1000;
+			syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAIT, old, timeout_ms >= 0 ? &ts : 0, 0, 0); // shared futex, works between processes
+#else
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+		}
+		waiters.fetch_sub(1);
+		if (word.load(std::memory_order_acquire) != old) return true;
+	}
+}
+
+static void shm_wake(std::atomic<uint32_t>& word, std::atomic<uint32_t>& waiters)
+{
+#ifdef __linux__
+	if (waiters.load() > 0)
+		syscall(SYS_futex, reinterpret_cast<int*>(&word), FUTEX_WAKE, INT_MAX, 0, 0, 0);
+#endif
+}
+
+void SharedMemoryGame::_map(size_t want_bytes)
+{
+	bytes = want_bytes;
+	void* p = mmap(0, bytes, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p==MAP_FAILED) throw std::runtime_error("cannot map shared memory '" + name + "': " + strerror(errno));
+	mem = (uint8_t*) p;
+	header = (ShmHeader*) mem;
+}
+
+SharedMemoryGame::SharedMemoryGame(const std::string& game_server_guid, int players, int obs_max, int act_max, int rgb_max):
+	name("/roboschool_" + game_server_guid), owner(true)
+{
+	shm_unlink(name.c_str()); // left from crashed server
+	fd = shm_open(name.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
+	if (fd==-1) throw std::runtime_error("cannot create shared memory '" + name + "': " + strerror(errno));
+	uint32_t stride = align64(sizeof(ShmSlot)) + align64(sizeof(float)*obs_max) + align64(sizeof(float)*act_max) + align64(rgb_max);
+	size_t want_bytes = align64(sizeof(ShmHeader)) + size_t(stride)*players;
+	if (ftruncate(fd, want_bytes) != 0) throw std::runtime_error("cannot resize shared memory '" + name + "': " + strerror(errno));
+	_map(want_bytes); // zero filled
+	header->players = players;
+	header->obs_max = obs_max;
+	header->act_max = act_max;
+	header->rgb_max = rgb_max;
+	header->slot_stride = stride;
+	latency.resize(players);
+	header->magic.store(SHM_MAGIC, std::memory_order_release);
+}
+
+SharedMemoryGame::SharedMemoryGame(const std::string& game_server_guid, int timeout_ms):
+	name("/roboschool_" + game_server_guid), owner(false)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while (1) {
+		fd = shm_open(name.c_str(), O_RDWR, 0600);
+		if (fd != -1) {
+			struct stat st;
+			if (fstat(fd, &st)==0 && st.st_size >= (off_t) sizeof(ShmHeader)) {
+				_map(st.st_size);
+				if (header->magic.load(std::memory_order_acquire)==SHM_MAGIC) break;
+				munmap(mem, bytes);
+				mem = 0;
+				header = 0;
+			}
+			close(fd);
+			fd = -1;
+		}
+		if (std::chrono::steady_clock::now() > deadline)
+			throw std::runtime_error("multiplayer server '" + game_server_guid + "' didn't create shared memory '" + name + "' in time");
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	size_t want_bytes = align64(sizeof(ShmHeader)) + size_t(header->slot_stride)*header->players;
+	if (bytes < want_bytes) throw std::runtime_error("shared memory '" + name + "' is too small, server and client versions differ?");
+}
+
+SharedMemoryGame::~SharedMemoryGame()
+{
+	if (mem) munmap(mem, bytes);
+	if (fd != -1) close(fd);
+	if (owner) shm_unlink(name.c_str());
+}
+
+ShmSlot* SharedMemoryGame::slot(int player)
+{
+	if (player < 0 || player >= header->players) throw std::runtime_error("multiplayer: player " + std::to_string(player) + " out of range");
+	return (ShmSlot*) (mem + align64(sizeof(ShmHeader)) + size_t(header->slot_stride)*player);
+}
+
+float* SharedMemoryGame::obs(int player)
+{
+	return (float*) ((uint8_t*) slot(player) + align64(sizeof(ShmSlot)));
+}
+
+float* SharedMemoryGame::act(int player)
+{
+	return (float*) ((uint8_t*) obs(player) + align64(sizeof(float)*header->obs_max));
+}
+
+uint8_t* SharedMemoryGame::rgb(int player)
+{
+	return (uint8_t*) act(player) + align64(sizeof(float)*header->act_max);
+}
+
+uint32_t SharedMemoryGame::client_request(int player, uint32_t cmd, int timeout_ms)
+{
+	ShmSlot* s = slot(player);
+	uint32_t seq = s->req_seq.load(std::memory_order_relaxed) + 1;
+	s->cmd = cmd;
+	s->req_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	s->req_seq.store(seq); // publishes cmd and slot data
+	shm_wake(s->req_seq, s->req_waiters);
+	header->any_req_seq.fetch_add(1);
+	shm_wake(header->any_req_seq, header->any_req_waiters);
+	if (!shm_wait(s->resp_seq, seq-1, s->resp_waiters, timeout_ms)) return 0;
+	return s->resp;
+}
+
+uint32_t SharedMemoryGame::server_wait(int player, int timeout_ms)
+{
+	ShmSlot* s = slot(player);
+	uint32_t answered = s->resp_seq.load(std::memory_order_relaxed);
+	if (!shm_wait(s->req_seq, answered, s->req_waiters, timeout_ms)) return 0;
+	return s->cmd;
+}
+
+void SharedMemoryGame::server_respond(int player, uint32_t resp)
+{
+	ShmSlot* s = slot(player);
+	s->resp = resp;
+	s->resp_seq.store(s->req_seq.load(std::memory_order_acquire)); // publishes resp and slot data
+	shm_wake(s->resp_seq, s->resp_waiters);
+	if (owner) {
+		latency[player].responded_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		latency[player].responded = true;
+	}
+}
+
+bool SharedMemoryGame::_pending(int player)
+{
+	ShmSlot* s = slot(player);
+	uint32_t req = s->req_seq.load(std::memory_order_acquire);
+	if (req == s->resp_seq.load(std::memory_order_relaxed)) return false;
+	PlayerLatency& l = latency[player];
+	if (l.seen_seq != req) {
+		l.seen_seq = req;
+		if (l.responded) {
+			double us = std::max(int64_t(0), s->req_ns - l.responded_ns) / 1000.0; // not when server got to it, that's server's own step time
+			l.count++;
+			l.sum_us += us;
+			if (us > l.max_us) l.max_us = us;
+		}
+	}
+	return true;
+}
+
+void SharedMemoryGame::step_begin(int deadline_ms)
+{
+	step_has_deadline = deadline_ms >= 0;
+	step_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(deadline_ms, 0));
+}
+
+int SharedMemoryGame::wait_any(const std::vector<int>& players)
+{
+	while (1) {
+		uint32_t any = header->any_req_seq.load(); // before checking slots, so request arriving after the check wakes us
+		for (int p: players)
+			if (_pending(p)) return p;
+		int timeout_ms = -1;
+		if (step_has_deadline) {
+			auto left = step_deadline - std::chrono::steady_clock::now();
+			if (left <= std::chrono::steady_clock::duration::zero()) return -1;
+			timeout_ms = (int) std::chrono::duration_cast<std::chrono::milliseconds>(left).count() + 1;
+		}
+		shm_wait(header->any_req_seq, any, header->any_req_waiters, timeout_ms);
+	}
+}
+
+int SharedMemoryGame::poll_any(const std::vector<int>& players)
+{
+	for (int p: players)
+		if (_pending(p)) return p;
+	return -1;
+}
+
+void SharedMemoryGame::stragglers(const std::vector<int>& players)
+{
+	for (int p: players) {
+		slot(p); // range check
+		latency[p].late++;
+	}
+}
+
+}
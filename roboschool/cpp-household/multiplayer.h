@@ -0,0 +1,99 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <stdint.h>
+
+namespace Household {
+
+// Multiplayer transport: one shared memory segment per game, header and then a slot per player.
+// Client writes command into its slot and increments req_seq, server writes response and sets
+// resp_seq to the same value. Waiting side polls for a few microseconds, then sleeps on futex,
+// waking side only makes a syscall if somebody sleeps. No pipes, no parsing.
+
+enum {
+	SHM_CMD_ENV_ID    = 'E', // env_id in slot, server creates env and fills sizes
+	SHM_CMD_ACTION    = 'a',
+	SHM_CMD_RESET     = 'R',
+	SHM_CMD_RENDER    = 'G',
+	SHM_RESP_ACCEPTED = 'A',
+	SHM_RESP_TUPLE    = 't',
+	SHM_RESP_DONE     = 'D',
+	SHM_RESP_OBS      = 'o',
+	SHM_RESP_IMAGE    = 'i',
+	SHM_RESP_ERROR    = 'X',
+};
+
+struct ShmSlot {
+	std::atomic<uint32_t> req_seq;
+	std::atomic<uint32_t> resp_seq;
+	std::atomic<uint32_t> req_waiters;  // server sleeping on req_seq
+	std::atomic<uint32_t> resp_waiters; // client sleeping on resp_seq
+	uint32_t cmd;
+	uint32_t resp;
+	int32_t obs_n, act_n, rgb_w, rgb_h; // actual sizes, set by server on SHM_CMD_ENV_ID
+	float rew;
+	int64_t req_ns; // client's steady_clock when it posted request, same clock in all processes (CLOCK_MONOTONIC)
+	char env_id[128];
+};
+
+struct ShmHeader {
+	std::atomic<uint32_t> magic; // written last by server, client waits for it
+	int32_t players;
+	int32_t obs_max, act_max, rgb_max;
+	uint32_t slot_stride;
+	std::atomic<uint32_t> any_req_seq; // bumped after every request, server waits on it for all players at once
+	std::atomic<uint32_t> any_req_waiters;
+};
+
+// Server side only, time from response to next request of a player, as client posted it
+struct PlayerLatency {
+	int    count = 0;
+	double sum_us = 0;
+	double max_us = 0;
+	int    late = 0; // steps simulated without this player's action, see SharedMemoryGame::stragglers()
+	uint32_t seen_seq = 0;
+	int64_t responded_ns = 0;
+	bool   responded = false;
+};
+
+struct SharedMemoryGame {
+	std::string name;
+	bool owner;
+	int fd = -1;
+	size_t bytes = 0;
+	uint8_t* mem = 0;
+	ShmHeader* header = 0;
+
+	SharedMemoryGame(const std::string& game_server_guid, int players, int obs_max, int act_max, int rgb_max); // server creates segment
+	SharedMemoryGame(const std::string& game_server_guid, int timeout_ms); // client attaches, waits for server
+	~SharedMemoryGame();
+
+	int      players() const  { return header->players; }
+	ShmSlot* slot(int player);
+	float*   obs(int player);
+	float*   act(int player);
+	uint8_t* rgb(int player);
+
+	uint32_t client_request(int player, uint32_t cmd, int timeout_ms); // response, 0 on timeout
+	uint32_t server_wait(int player, int timeout_ms);                  // pending command, 0 on timeout
+	void     server_respond(int player, uint32_t resp);
+
+	// Lockstep with deadline: step_begin(), then wait_any() on players that didn't send action yet,
+	// until all did, or deadline passed. Players still missing go to stragglers(), server applies
+	// their previous (or zero) action and steps without them.
+	std::chrono::steady_clock::time_point step_deadline;
+	bool step_has_deadline = false;
+	std::vector<PlayerLatency> latency;
+	void step_begin(int deadline_ms); // -1 no deadline, wait for everybody as before
+	int  wait_any(const std::vector<int>& players); // player with pending command, -1 if deadline passed
+	int  poll_any(const std::vector<int>& players); // same, doesn't wait
+	void stragglers(const std::vector<int>& players);
+
+private:
+	void _map(size_t bytes);
+	bool _pending(int player);
+};
+
+}
@@ -2,13 +2,11 @@
 #include <QtWidgets/QApplication>
 #include <QtCore/QDir>
 #include <QtCore/QElapsedTimer>
+#include <stdexcept>
+#include <algorithm>
 
 namespace Household {
 
-#ifdef CHROME_TRACING
-static int chrome_trace_log = -1;
-#endif
-
 void World::bullet_init(float gravity, float timestep)
 {
 	char* fake_argv[] = { 0 };
@@ -18,32 +16,34 @@ void World::bullet_init(float gravity, float timestep)
 	settings_gravity = gravity;
 	settings_timestep = timestep;
 	settings_apply();
+}
+
+World::~World()
+{
+	bullet_trace_stop();
+	b3DisconnectSharedMemory(client);
+}
 
-#ifdef CHROME_TRACING
-	b3SharedMemoryCommandHandle command;
-	command = b3StateLoggingCommandInit(client);
-	b3StateLoggingStart(command, STATE_LOGGING_PROFILE_TIMINGS, "chrome_tracing.json");
+void World::bullet_trace_start(const std::string& fn)
+{
+	bullet_trace_stop();
+	b3SharedMemoryCommandHandle command = b3StateLoggingCommandInit(client);
+	b3StateLoggingStart(command, STATE_LOGGING_PROFILE_TIMINGS, fn.c_str());
 	b3SharedMemoryStatusHandle status = b3SubmitClientCommandAndWaitStatus(client, command);
-	int status_type = b3GetStatusType(status);
-	if (status_type == CMD_STATE_LOGGING_START_COMPLETED) {
-		chrome_trace_log = b3GetStatusLoggingUniqueId(status);
-		fprintf(stderr, "Start chrome trace log, handle %i\n", chrome_trace_log);
+	if (b3GetStatusType(status) != CMD_STATE_LOGGING_START_COMPLETED) {
+		fprintf(stderr, "Cannot start bullet profile log '%s'\n", fn.c_str());
+		return;
 	}
-#endif
+	bullet_trace_log = b3GetStatusLoggingUniqueId(status);
 }
 
-World::~World()
+void World::bullet_trace_stop()
 {
-#ifdef CHROME_TRACING
-	if (chrome_trace_log!=-1) {
-		fprintf(stderr, "Stop chrome trace log, handle %i\n", chrome_trace_log);
-		b3SharedMemoryCommandHandle command = b3StateLoggingCommandInit(client);
-		b3StateLoggingStop(command, chrome_trace_log);
-		b3SubmitClientCommandAndWaitStatus(client, command);
-		chrome_trace_log = -1;
-	}
-#endif
-	b3DisconnectSharedMemory(client);
+	if (bullet_trace_log==-1) return;
+	b3SharedMemoryCommandHandle command = b3StateLoggingCommandInit(client);
+	b3StateLoggingStop(command, bullet_trace_log);
+	b3SubmitClientCommandAndWaitStatus(client, command);
+	bullet_trace_log = -1;
 }
 
 void World::settings_apply()
@@ -59,8 +59,14 @@ void World::clean_everything()
 		robot->bullet_handle = -1;
 	}
 	robotlist.clear();
+	for (const weak_ptr<Thingy>& w: drawlist) {
+		shared_ptr<Thingy> t = w.lock();
+		if (t) t->instance_id = 0; // new id if added again, numbering starts over
+	}
 	drawlist.clear();
+	instance_id_last = 0;
 	bullet_handle_to_robot.clear();
+	loads.clear();
 	ts = 0;
 	settings_timestep_sent = 0;
 	settings_apply();
@@ -69,6 +75,7 @@ void World::clean_everything()
 
 shared_ptr<Robot> World::load_urdf(const std::string& fn, const btTransform& tr, bool fixed_base, bool self_collision)
 {
+	TRACE_SPAN("load_urdf");
 	shared_ptr<Robot> robot(new Robot);
 	robot->original_urdf_name = fn;
 	int statusType;
@@ -90,11 +97,21 @@ shared_ptr<Robot> World::load_urdf(const std::string& fn, const btTransform& tr,
 	robotlist.push_back(robot);
 	bullet_handle_to_robot[robot->bullet_handle] = robot;
     robot->root_part->bullet_handle = robot->bullet_handle;
+	WorldLoad l;
+	l.kind = WorldLoad::URDF;
+	l.fn = fn;
+	l.tr = tr;
+	l.fixed_base = fixed_base;
+	l.self_collision = self_collision;
+	l.bullet_handles.push_back(robot->bullet_handle);
+	l.robots.push_back(robot);
+	loads.push_back(l);
 	return robot;
 }
 
 std::list<shared_ptr<Robot>> World::load_sdf_mjcf(const std::string& fn, bool mjcf)
 {
+	TRACE_SPAN(mjcf ? "load_mjcf" : "load_sdf");
 	std::list<shared_ptr<Robot>> ret;
 	const int MAX_SDF_BODIES = 512;
 	int bodyIndicesOut[MAX_SDF_BODIES];
@@ -119,6 +136,10 @@ std::list<shared_ptr<Robot>> World::load_sdf_mjcf(const std::string& fn, bool mj
 	}
 	if (N > MAX_SDF_BODIES)
 		fprintf(stderr, "'%s': too many bodies (%i).\n", fn.c_str(), N);
+	WorldLoad l;
+	l.kind = mjcf ? WorldLoad::MJCF : WorldLoad::SDF;
+	l.fn = fn;
+	l.tr.setIdentity();
 	for (int c=0; c<N; c++) {
 		shared_ptr<Robot> robot(new Robot);
 		robot->bullet_handle = bodyIndicesOut[c];
@@ -127,7 +148,10 @@ std::list<shared_ptr<Robot>> World::load_sdf_mjcf(const std::string& fn, bool mj
 		robotlist.push_back(robot);
 		bullet_handle_to_robot[robot->bullet_handle] = robot;
 		ret.push_back(robot);
+		l.bullet_handles.push_back(robot->bullet_handle);
+		l.robots.push_back(robot);
 	}
+	loads.push_back(l);
 	return ret;
 }
 
@@ -186,6 +210,7 @@ void load_shape_into_class(
 
 shared_ptr<Thingy> World::load_thingy(const std::string& the_filename, const btTransform& tr, float scale, float mass, uint32_t color, bool decoration_only)
 {
+	TRACE_SPAN("load_thingy");
 	shared_ptr<ThingyClass> klass = klass_cache_find_or_create(the_filename);
 	shared_ptr<Thingy> t(new Thingy());
 	t->klass = klass;
@@ -347,6 +372,13 @@ void World::thingy_add_to_drawlist(const shared_ptr<Thingy>& t)
 {
 	if (!t->in_drawlist) {
 		t->in_drawlist = true;
+		if (!t->instance_id) {
+			if (instance_id_last == INSTANCE_ID_MAX) {
+				fprintf(stderr, "more than %i instances since clean_everything(), instance ids wrap and are no longer unique\n", INSTANCE_ID_MAX);
+				instance_id_last = 0;
+			}
+			t->instance_id = ++instance_id_last;
+		}
 		drawlist.push_back(t);
 	}
 }
@@ -358,13 +390,24 @@ void Thingy::remove_from_bullet()
 
 void World::bullet_step(int skip_frames)
 {
+	TRACE_SPAN("bullet_step");
+	TraceSpan trace_submit("submit");
 	QElapsedTimer elapsed;
 	elapsed.start();
 
-	float need_timestep = settings_timestep*skip_frames;
+	bool pd = false;
+	for (const boost::weak_ptr<Robot>& wr: robotlist) {
+		boost::shared_ptr<Robot> robot = wr.lock();
+		if (robot && !robot->pd_joints.empty()) pd = true;
+	}
+	// PD torques depend on joint state, so bullet does one substep per call and we recompute them in between
+	int substeps = pd ? 1 : skip_frames;
+	int calls    = pd ? skip_frames : 1;
+
+	float need_timestep = settings_timestep*substeps;
 	if (
 		settings_timestep_sent != need_timestep ||
-		settings_skip_frames_sent != skip_frames
+		settings_skip_frames_sent != substeps
 	) {
 		b3SharedMemoryCommandHandle command = b3InitPhysicsParamCommand(client);
 		b3PhysicsParamSetGravity(command, 0, 0, -settings_gravity);
@@ -372,44 +415,81 @@ void World::bullet_step(int skip_frames)
 		b3PhysicsParamSetDefaultContactERP(command, 0.9);
 		b3PhysicsParamSetTimeStep(command, need_timestep);
 		settings_timestep_sent = need_timestep;
-		b3PhysicsParamSetNumSubSteps(command, skip_frames);
-		settings_skip_frames_sent = skip_frames;
+		b3PhysicsParamSetNumSubSteps(command, substeps);
+		settings_skip_frames_sent = substeps;
 		b3SubmitClientCommandAndWaitStatus(client, command);
 	}
 
-	for (const boost::weak_ptr<Robot>& wr: robotlist) {
-		boost::shared_ptr<Robot> robot = wr.lock();
-		if (!robot) continue;
-		b3SharedMemoryCommandHandle cmd = 0;
-		for (const shared_ptr<Joint>& j: robot->joints) {
-			if (!j) continue;
-			if (j->torque_need_repeat) {
+	qint64 ns_post_joints = 0;
+	qint64 ns_step = 0;
+	qint64 ns_query = 0;
+	for (int c=0; c<calls; c++) {
+		if (c > 0) {
+			trace_submit.begin("submit");
+			elapsed.start();
+		}
+		for (const boost::weak_ptr<Robot>& wr: robotlist) {
+			boost::shared_ptr<Robot> robot = wr.lock();
+			if (!robot) continue;
+			b3SharedMemoryCommandHandle cmd = 0;
+			for (const shared_ptr<Joint>& j: robot->joints) {
+				if (!j) continue;
+				if (j->torque_need_repeat) {
+					if (!cmd) cmd = b3JointControlCommandInit2(client, robot->bullet_handle, CONTROL_MODE_TORQUE);
+					b3JointControlSetDesiredForceTorque(cmd, j->bullet_uindex, j->torque_repeat_val);
+				}
+			}
+			for (PdJoint& pj: robot->pd_joints) {
+				Joint* j = pj.joint.get();
+				float torque =
+					pj.kp*(pj.target_pos - j->joint_current_position) +
+					pj.kd*(pj.target_speed - j->joint_current_speed);
+				torque = std::max(-pj.max_torque, std::min(+pj.max_torque, torque));
+				pj.last_torque = torque;
 				if (!cmd) cmd = b3JointControlCommandInit2(client, robot->bullet_handle, CONTROL_MODE_TORQUE);
-				b3JointControlSetDesiredForceTorque(cmd, j->bullet_uindex, j->torque_repeat_val);
+				b3JointControlSetDesiredForceTorque(cmd, j->bullet_uindex, torque);
+			}
+			if (cmd) {
+				b3SubmitClientCommandAndWaitStatus(client, cmd);
+				metrics.count(COUNTER_JOINT_COMMANDS, 1);
 			}
 		}
-		if (cmd) b3SubmitClientCommandAndWaitStatus(client, cmd);
-	}
-
-	double ms_post_joints = elapsed.nsecsElapsed() / 1000000.0;
-	elapsed.start();
 
-	b3SharedMemoryCommandHandle cmd = b3InitStepSimulationCommand(client);
-	b3SubmitClientCommandAndWaitStatus(client, cmd);
+		ns_post_joints += elapsed.nsecsElapsed();
+		trace_submit.end();
+		elapsed.start();
+
+		TraceSpan trace_step("step");
+		b3SharedMemoryCommandHandle cmd = b3InitStepSimulationCommand(client);
+		b3SubmitClientCommandAndWaitStatus(client, cmd);
+		trace_step.end();
+		ns_step += elapsed.nsecsElapsed();
+
+		if (c+1 < calls) {
+			// joint state for next substep, full query of everything is done after last one
+			elapsed.start();
+			TraceSpan trace_query("query_pd");
+			for (const boost::weak_ptr<Robot>& wr: robotlist) {
+				boost::shared_ptr<Robot> robot = wr.lock();
+				if (robot && !robot->pd_joints.empty()) query_body_position(robot);
+			}
+			trace_query.end();
+			ns_query += elapsed.nsecsElapsed();
+		}
+	}
 
 	ts += settings_timestep*skip_frames;
 
-	double ms_step = elapsed.nsecsElapsed() / 1000000.0;
 	elapsed.start();
+	TraceSpan trace_query("query");
 	query_positions();
-	double ms_query = elapsed.nsecsElapsed() / 1000000.0;
-
-	static double mean;
-	mean *= 0.95;
-	mean += 0.05*ms_step;
-	//fprintf(stderr, "j=%0.2lf, step=%0.2lf (mean=%0.2f), query=%0.2lf\n", ms_post_joints, ms_step, mean, ms_query);
+	trace_query.end();
+	ns_query += elapsed.nsecsElapsed();
 
-	performance_bullet_ms = ms_post_joints + ms_step + ms_query;
+	metrics.record(METRIC_SUBMIT, ns_post_joints);
+	metrics.record(METRIC_STEP, ns_step);
+	metrics.record(METRIC_QUERY, ns_query);
+	performance_bullet_ms = (ns_post_joints + ns_step + ns_query) / 1000000.0;
 }
 
 void World::query_positions()
@@ -440,6 +520,7 @@ btTransform transform_from_doubles(const double* pos, const double* quat)
 
 void World::query_body_position(const shared_ptr<Robot>& robot)
 {
+	TRACE_SPAN("query_body_position");
 	if (!robot->root_part) return;
 
 	b3SharedMemoryCommandHandle cmd_handle = b3RequestActualStateCommandInit(client, robot->bullet_handle);
@@ -518,8 +599,14 @@ void Joint::set_target_speed(float target_speed, float kd, float maxforce)
 	b3JointControlSetKd(cmd,              bullet_uindex, kd);
 	b3JointControlSetMaximumForce(cmd,    bullet_uindex, maxforce);
 	b3SubmitClientCommandAndWaitStatus(w->client, cmd);
+	w->metrics.count(COUNTER_JOINT_COMMANDS, 1);
 	first_torque_call = true;
 	torque_need_repeat = false;
+	motor_mode = CONTROL_MODE_VELOCITY;
+	motor_target = target_speed;
+	motor_kp = 0;
+	motor_kd = kd;
+	motor_max_force = maxforce;
 }
 
 void Joint::set_servo_target(float target_pos, float kp, float kd, float maxforce)
@@ -533,8 +620,14 @@ void Joint::set_servo_target(float target_pos, float kp, float kd, float maxforc
 	b3JointControlSetKd(cmd,              bullet_uindex, kd);
 	b3JointControlSetMaximumForce(cmd,    bullet_uindex, maxforce);
 	b3SubmitClientCommandAndWaitStatus(w->client, cmd);
+	w->metrics.count(COUNTER_JOINT_COMMANDS, 1);
 	first_torque_call = true;
 	torque_need_repeat = false;
+	motor_mode = CONTROL_MODE_POSITION_VELOCITY_PD;
+	motor_target = target_pos;
+	motor_kp = kp;
+	motor_kd = kd;
+	motor_max_force = maxforce;
 }
 
 void Joint::set_relative_servo_target(float target_pos, float kp, float kd)
@@ -545,6 +638,42 @@ void Joint::set_relative_servo_target(float target_pos, float kp, float kd)
 		joint_max_force ? joint_max_force : 40); // 40 is about as strong as humanoid hands
 }
 
+void Robot::pd_joint_add(const shared_ptr<Joint>& j, float kp, float kd, float max_torque)
+{
+	if (j->first_torque_call) {
+		j->set_servo_target(0, 0.1, 0.1, 0); // turns off bullet motor, as set_motor_torque() does
+		j->first_torque_call = false;
+	}
+	j->torque_need_repeat = false;
+	for (PdJoint& pj: pd_joints) {
+		if (pj.joint != j) continue;
+		pj.kp = kp;
+		pj.kd = kd;
+		pj.max_torque = max_torque;
+		return;
+	}
+	PdJoint pj;
+	pj.joint = j;
+	pj.kp = kp;
+	pj.kd = kd;
+	pj.max_torque = max_torque;
+	pj.target_pos = j->joint_current_position; // holds still until first targets
+	pd_joints.push_back(pj);
+}
+
+void Robot::pd_set_targets(const float* pos, const float* speed)
+{
+	for (size_t i=0; i<pd_joints.size(); i++) {
+		pd_joints[i].target_pos = pos[i];
+		pd_joints[i].target_speed = speed ? speed[i] : 0;
+	}
+}
+
+void Robot::pd_clear()
+{
+	pd_joints.clear(); // joints stay limp until other control method is called
+}
+
 void Joint::joint_current_relative_position(float* pos, float* speed)
 {
 	float rpos, rspeed;
@@ -575,6 +704,7 @@ void Joint::reset_current_position(float pos, float vel)
 	b3CreatePoseCommandSetJointPosition(w->client, cmd, bullet_joint_n, pos);
 	b3CreatePoseCommandSetJointVelocity(w->client, cmd, bullet_joint_n, vel);
 	b3SubmitClientCommandAndWaitStatus(w->client, cmd);
+	w->metrics.count(COUNTER_JOINT_COMMANDS, 1);
 }
 
 void Joint::activate()
@@ -594,8 +724,121 @@ void World::robot_move(const shared_ptr<Robot>& robot, const btTransform& tr, co
 	b3SubmitClientCommandAndWaitStatus(client, cmd);
 }
 
+shared_ptr<World> World::clone(std::vector<shared_ptr<Robot>>* robots)
+{
+	TRACE_SPAN("clone");
+	shared_ptr<World> w(new World);
+	w->app_ref = app_ref;
+	w->klass_cache = klass_cache; // classes are frozen after first load, clone shares visual shapes and textures
+	w->bullet_init(settings_gravity, settings_timestep);
+	std::map<Robot*, shared_ptr<Robot>> twin; // also keeps clone robots alive until state is copied
+	for (const WorldLoad& l: loads) {
+		std::list<shared_ptr<Robot>> got;
+		if (l.kind==WorldLoad::URDF)
+			got.push_back(w->load_urdf(l.fn, l.tr, l.fixed_base, l.self_collision));
+		else
+			got = w->load_sdf_mjcf(l.fn, l.kind==WorldLoad::MJCF);
+		if (w->loads.empty() || w->loads.back().bullet_handles != l.bullet_handles)
+			throw std::runtime_error("clone(): '" + l.fn + "' loaded into different bullet bodies than in source world");
+		auto r = got.begin();
+		for (const weak_ptr<Robot>& wr: l.robots) {
+			shared_ptr<Robot> src = wr.lock();
+			if (src) twin[src.get()] = *r;
+			++r;
+		}
+	}
+	w->state_copy_from(this);
+	for (const weak_ptr<Robot>& wr: robotlist) {
+		shared_ptr<Robot> src = wr.lock();
+		if (!src) continue;
+		auto f = twin.find(src.get());
+		if (f != twin.end()) robots->push_back(f->second);
+	}
+	return w;
+}
+
+static
+void body_state_copy(b3PhysicsClientHandle src, b3PhysicsClientHandle dst, int handle)
+{
+	b3SharedMemoryStatusHandle status = b3SubmitClientCommandAndWaitStatus(src, b3RequestActualStateCommandInit(src, handle));
+	if (b3GetStatusType(status) != CMD_ACTUAL_STATE_UPDATE_COMPLETED) return;
+	const double* q;
+	const double* q_dot;
+	b3GetStatusActualState(status, 0, 0, 0, 0, &q, &q_dot, 0);
+
+	b3SharedMemoryCommandHandle cmd = b3CreatePoseCommandInit(dst, handle);
+	b3CreatePoseCommandSetBasePosition(cmd, q[0], q[1], q[2]);
+	b3CreatePoseCommandSetBaseOrientation(cmd, q[3], q[4], q[5], q[6]);
+	double lin[3] = { q_dot[0], q_dot[1], q_dot[2] };
+	double ang[3] = { q_dot[3], q_dot[4], q_dot[5] };
+	b3CreatePoseCommandSetBaseLinearVelocity(cmd, lin);
+	b3CreatePoseCommandSetBaseAngularVelocity(cmd, ang);
+	int cnt = b3GetNumJoints(src, handle);
+	for (int c=0; c<cnt; c++) {
+		struct b3JointInfo info;
+		b3GetJointInfo(src, handle, c, &info);
+		if (info.m_jointType!=eRevoluteType && info.m_jointType!=ePrismaticType) continue; // same as load_robot_joints(), fixed joints have no state
+		b3CreatePoseCommandSetJointPosition(dst, cmd, c, q[info.m_qIndex]);
+		b3CreatePoseCommandSetJointVelocity(dst, cmd, c, q_dot[info.m_uIndex]);
+	}
+	b3SubmitClientCommandAndWaitStatus(dst, cmd);
+}
+
+static
+void robot_controls_copy(const shared_ptr<Robot>& src, const shared_ptr<Robot>& dst)
+{
+	for (size_t c=0; c<src->joints.size() && c<dst->joints.size(); c++) {
+		const shared_ptr<Joint>& a = src->joints[c];
+		const shared_ptr<Joint>& b = dst->joints[c];
+		if (!a || !b) continue;
+		bool same_motor =
+			a->motor_mode==b->motor_mode && a->motor_target==b->motor_target &&
+			a->motor_kp==b->motor_kp && a->motor_kd==b->motor_kd && a->motor_max_force==b->motor_max_force;
+		if (!same_motor) { // joint never commanded in src keeps motor of dst
+			if (a->motor_mode==CONTROL_MODE_VELOCITY)
+				b->set_target_speed(a->motor_target, a->motor_kd, a->motor_max_force);
+			else if (a->motor_mode==CONTROL_MODE_POSITION_VELOCITY_PD)
+				b->set_servo_target(a->motor_target, a->motor_kp, a->motor_kd, a->motor_max_force);
+		}
+		b->first_torque_call = a->first_torque_call;
+		b->torque_need_repeat = a->torque_need_repeat;
+		b->torque_repeat_val = a->torque_repeat_val;
+	}
+	dst->pd_joints.clear();
+	for (const PdJoint& pj: src->pd_joints) {
+		auto f = std::find(src->joints.begin(), src->joints.end(), pj.joint);
+		if (f==src->joints.end() || size_t(f - src->joints.begin()) >= dst->joints.size()) continue;
+		PdJoint copy = pj;
+		copy.joint = dst->joints[f - src->joints.begin()];
+		dst->pd_joints.push_back(copy);
+	}
+}
+
+void World::state_copy_from(World* src)
+{
+	TRACE_SPAN("state_copy_from");
+	if (loads.size() != src->loads.size())
+		throw std::runtime_error("copy_state_from(): source world has " + std::to_string(src->loads.size()) + " loads, this world has " + std::to_string(loads.size()));
+	for (size_t i=0; i<loads.size(); i++) {
+		const WorldLoad& a = src->loads[i];
+		const WorldLoad& b = loads[i];
+		if (a.kind!=b.kind || a.fn!=b.fn || a.bullet_handles!=b.bullet_handles)
+			throw std::runtime_error("copy_state_from(): '" + b.fn + "' doesn't match '" + a.fn + "' loaded in source world");
+		for (size_t c=0; c<a.bullet_handles.size(); c++) {
+			body_state_copy(src->client, client, a.bullet_handles[c]);
+			shared_ptr<Robot> ra = a.robots[c].lock();
+			shared_ptr<Robot> rb = b.robots[c].lock();
+			if (!rb) continue;
+			if (ra) robot_controls_copy(ra, rb);
+			query_body_position(rb);
+		}
+	}
+	ts = src->ts;
+}
+
 std::list<shared_ptr<Household::Thingy>> World::bullet_contact_list(const shared_ptr<Thingy>& t)
 {
+	MetricsTimer timer(&metrics, METRIC_CONTACTS);
 	b3SharedMemoryCommandHandle cmd = b3InitRequestContactPointInformation(client);
 	b3SetContactFilterBodyA(cmd, t->bullet_handle);
 	b3SetContactFilterLinkA(cmd, t->bullet_link_n);
@@ -604,6 +847,7 @@ std::list<shared_ptr<Household::Thingy>> World::bullet_contact_list(const shared
 	b3ContactInformation contacts;
 	assert(statusType==CMD_CONTACT_POINT_INFORMATION_COMPLETED);
 	b3GetContactPointInformation(client, &contacts);
+	metrics.count(COUNTER_CONTACT_POINTS, contacts.m_numContactPoints);
 
 	std::list<shared_ptr<Household::Thingy>> result;
 	for (int c=0; c<contacts.m_numContactPoints; c++) {
@@ -0,0 +1,170 @@
+#include "policy.h"
+#include "household.h"
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+
+namespace Household {
+
+// GCC/clang vector extension: compiles to AVX with -march=native, or pairs of SSE/NEON registers otherwise
+typedef float v8f __attribute__((vector_size(32)));
+
+static float* aligned_floats(size_t n)
+{
+	void* p = 0;
+	if (posix_memalign(&p, 32, sizeof(float)*std::max(n, size_t(8))) != 0) throw std::bad_alloc();
+	return (float*) p;
+}
+
+MlpPolicy::~MlpPolicy()
+{
+	for (MlpLayer& l: layers) {
+		free(l.w);
+		free(l.b);
+	}
+	free(scratch[0]);
+	free(scratch[1]);
+}
+
+void MlpPolicy::layer_add(int in, int out, const float* w, const float* b, bool relu)
+{
+	if (in <= 0 || out <= 0) throw std::runtime_error("MlpPolicy: layer must have positive size");
+	if (!layers.empty() && layers.back().out != in)
+		throw std::runtime_error("MlpPolicy: layer input " + std::to_string(in) + " doesn't match previous layer output " + std::to_string(layers.back().out));
+	MlpLayer l;
+	l.in = in;
+	l.out = out;
+	l.out_pad = (out + 7) & ~7;
+	l.relu = relu;
+	l.w = aligned_floats(size_t(in)*l.out_pad);
+	l.b = aligned_floats(l.out_pad);
+	memset(l.w, 0, sizeof(float)*in*l.out_pad);
+	memset(l.b, 0, sizeof(float)*l.out_pad);
+	for (int i=0; i<in; i++)
+		memcpy(l.w + size_t(i)*l.out_pad, w + size_t(i)*out, sizeof(float)*out);
+	memcpy(l.b, b, sizeof(float)*out);
+	layers.push_back(l);
+}
+
+size_t MlpPolicy::bytes() const
+{
+	size_t r = 0;
+	for (const MlpLayer& l: layers)
+		r += sizeof(float)*(size_t(l.in) + 1)*l.out_pad;
+	return r;
+}
+
+// R rows of x at once: every weight vector is loaded once and used R times
+template<int R>
+static void dense_rows(const MlpLayer& l, const float* x, int xs, float* y)
+{
+	for (int j=0; j<l.out_pad; j+=8) {
+		v8f acc[R];
+		for (int r=0; r<R; r++) acc[r] = *(const v8f*) (l.b + j);
+		const float* wj = l.w + j;
+		for (int i=0; i<l.in; i++) {
+			v8f w = *(const v8f*) (wj + size_t(i)*l.out_pad);
+			for (int r=0; r<R; r++) acc[r] += x[r*xs + i] * w;
+		}
+		v8f zero = { 0, 0, 0, 0, 0, 0, 0, 0 };
+		for (int r=0; r<R; r++)
+			*(v8f*) (y + r*l.out_pad + j) = l.relu ? (acc[r] > zero ? acc[r] : zero) : acc[r];
+	}
+}
+
+void MlpPolicy::act(const float* obs, int batch, float* act)
+{
+	if (layers.empty()) throw std::runtime_error("MlpPolicy: no layers");
+	if (batch <= 0) return;
+	int widest = 0;
+	for (const MlpLayer& l: layers) widest = std::max(widest, l.out_pad);
+	size_t need = size_t(batch)*widest;
+	if (need > scratch_floats) {
+		free(scratch[0]);
+		free(scratch[1]);
+		scratch[0] = scratch[1] = 0;
+		scratch[0] = aligned_floats(need);
+		scratch[1] = aligned_floats(need);
+		scratch_floats = need;
+	}
+
+	const float* x = obs;
+	int xs = obs_n();
+	int cur = 0;
+	for (const MlpLayer& l: layers) {
+		float* y = scratch[cur];
+		int r = 0;
+		for (; r+4<=batch; r+=4) dense_rows<4>(l, x + size_t(r)*xs, xs, y + size_t(r)*l.out_pad);
+		for (; r<batch; r++)     dense_rows<1>(l, x + size_t(r)*xs, xs, y + size_t(r)*l.out_pad);
+		x = y;
+		xs = l.out_pad;
+		cur ^= 1;
+	}
+
+	int n = act_n();
+	for (int r=0; r<batch; r++)
+		memcpy(act + size_t(r)*n, x + size_t(r)*xs, sizeof(float)*n);
+}
+
+void BotPlayer::observe()
+{
+	obs.resize(2*obs_joints.size() + obs_extra.size());
+	float* o = obs.data();
+	for (const BotObsJoint& bj: obs_joints) {
+		float pos = 0, speed = 0;
+		shared_ptr<Joint> j = bj.joint.lock();
+		if (j) j->joint_current_relative_position(&pos, &speed);
+		*o++ = bj.pos_mul*pos;
+		*o++ = bj.speed_mul*speed;
+	}
+	for (float x: obs_extra) *o++ = x;
+}
+
+void BotPlayer::apply()
+{
+	for (size_t i=0; i<act_joints.size() && i<act.size(); i++) {
+		const BotActJoint& ba = act_joints[i];
+		shared_ptr<Joint> j = ba.joint.lock();
+		if (!j) continue;
+		float a = std::isfinite(act[i]) ? std::max(-1.0f, std::min(+1.0f, act[i])) : 0;
+		j->set_target_speed(ba.scale*a, ba.kd, ba.maxforce);
+	}
+}
+
+void bots_step(const std::vector<shared_ptr<BotPlayer>>& bots)
+{
+	std::vector<bool> done(bots.size(), false);
+	std::vector<float> batch_obs, batch_act;
+	for (size_t i=0; i<bots.size(); i++) {
+		if (done[i]) continue;
+		MlpPolicy* policy = bots[i]->policy.get();
+		if (!policy) throw std::runtime_error("bot player has no policy");
+		int on = policy->obs_n();
+		int an = policy->act_n();
+		std::vector<BotPlayer*> group;
+		for (size_t k=i; k<bots.size(); k++) {
+			if (done[k] || bots[k]->policy.get()!=policy) continue;
+			bots[k]->observe();
+			if ((int) bots[k]->obs.size() != on)
+				throw std::runtime_error("bot player observes " + std::to_string(bots[k]->obs.size()) + " values, policy wants " + std::to_string(on));
+			group.push_back(bots[k].get());
+			done[k] = true;
+		}
+		int n = group.size();
+		batch_obs.resize(size_t(n)*on);
+		batch_act.resize(size_t(n)*an);
+		for (int b=0; b<n; b++)
+			memcpy(&batch_obs[size_t(b)*on], group[b]->obs.data(), sizeof(float)*on);
+		policy->act(batch_obs.data(), n, batch_act.data());
+		for (int b=0; b<n; b++) {
+			group[b]->act.assign(batch_act.begin() + size_t(b)*an, batch_act.begin() + size_t(b+1)*an);
+			group[b]->apply();
+		}
+	}
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <stddef.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+namespace Household {
+
+// Dense MLP policy, as in agent_zoo: x = relu(x*W1 + b1), x = relu(x*W2 + b2), ..., a = x*Wn + bn
+// Weights are copied once into 32-byte aligned rows, padded to 8 floats, so inner loop is
+// straight vector multiply-add. act() evaluates a batch, 4 observations share every weight load.
+// Not thread safe (scratch buffers are members), use one MlpPolicy per thread.
+
+struct MlpLayer {
+	int in, out;
+	int out_pad;    // out rounded up to 8
+	float* w = 0;   // in rows of out_pad, same order as numpy dot(x, w)
+	float* b = 0;   // out_pad
+	bool relu;
+};
+
+struct MlpPolicy {
+	std::vector<MlpLayer> layers;
+	MlpPolicy() { }
+	MlpPolicy(const MlpPolicy&) = delete;
+	MlpPolicy& operator=(const MlpPolicy&) = delete;
+	~MlpPolicy();
+
+	void layer_add(int in, int out, const float* w, const float* b, bool relu); // w is in*out row major, b is out
+	int  obs_n() const  { return layers.empty() ? 0 : layers.front().in; }
+	int  act_n() const  { return layers.empty() ? 0 : layers.back().out; }
+	size_t bytes() const;
+
+	void act(const float* obs, int batch, float* act); // obs is batch*obs_n(), act is batch*act_n()
+
+private:
+	float* scratch[2] = { 0, 0 };
+	size_t scratch_floats = 0;
+};
+
+// Server-side player: observation straight from joints, MlpPolicy, actions straight to joints,
+// no python and no client process per step. Env describes its observation and action layout once,
+// see RoboschoolPong.native_bot_setup().
+
+struct Joint;
+
+struct BotObsJoint {
+	boost::weak_ptr<Joint> joint;
+	float pos_mul, speed_mul; // observation is (pos_mul*relative_position, speed_mul*relative_speed)
+};
+
+struct BotActJoint {
+	boost::weak_ptr<Joint> joint;
+	float scale, kd, maxforce; // set_target_speed(scale*clip(a, -1, +1), kd, maxforce)
+};
+
+struct BotPlayer {
+	boost::shared_ptr<MlpPolicy> policy;
+	std::vector<BotObsJoint> obs_joints;
+	std::vector<float> obs_extra; // appended after joints, env updates it (pong timeout)
+	std::vector<BotActJoint> act_joints;
+	std::vector<float> obs;
+	std::vector<float> act;
+
+	void observe();
+	void apply();
+};
+
+void bots_step(const std::vector<boost::shared_ptr<BotPlayer>>& bots); // bots sharing a policy are evaluated in one batch
+
+}
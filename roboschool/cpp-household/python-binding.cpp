@@ -2,6 +2,10 @@
 #include <boost/weak_ptr.hpp>
 
 #include "render-glwidget.h"
+#include "multiplayer.h"
+#include "policy.h"
+#include "rollout.h"
+#include "dynamics.h"
 
 #include <QtWidgets/QApplication>
 #include <QtWidgets/QDesktopWidget>
@@ -79,6 +83,39 @@ struct Pose {
 	}
 };
 
+// index into Context::ssao_tier_ms, so checked before it gets there
+static int ssao_quality_check(int quality, const char* what)
+{
+	if (quality < Household::SSAO_OFF || quality > Household::SSAO_FULL)
+		throw std::runtime_error(std::string(what) + ": quality must be 0 off, 1 half resolution or 2 full, got " + std::to_string(quality));
+	return quality;
+}
+
+// float32 C contiguous buffer (numpy array, memoryview), released when out of scope
+struct FloatBuffer {
+	Py_buffer view;
+	FloatBuffer(const object& o, bool writable, const char* what)
+	{
+		if (PyObject_GetBuffer(o.ptr(), &view, PyBUF_FORMAT|PyBUF_C_CONTIGUOUS|(writable ? PyBUF_WRITABLE : 0)) != 0)
+			throw_error_already_set();
+		if (view.itemsize != 4 || !view.format || std::string(view.format).find('f')==std::string::npos) {
+			PyBuffer_Release(&view);
+			throw std::runtime_error(std::string(what) + " must be float32");
+		}
+	}
+	~FloatBuffer()  { PyBuffer_Release(&view); }
+	float* data()   { return (float*) view.buf; }
+	int floats()    { return int(view.len / 4); }
+	int dim(int i)  { return i < view.ndim ? int(view.shape[i]) : 1; }
+};
+
+// Other python threads run while this is in scope, so worlds from World.clone() step in parallel. Touch no python objects inside.
+struct GilRelease {
+	PyThreadState* save;
+	GilRelease(): save(PyEval_SaveThread())  { }
+	~GilRelease()  { PyEval_RestoreThread(save); }
+};
+
 struct Thingy {
 	shared_ptr<Household::Thingy> tref;
 	shared_ptr<Household::World>  wref;
@@ -103,6 +140,7 @@ struct Thingy {
 	void set_multiply_color(const std::string& tex, uint32_t c)  { tref->set_multiply_color(tex, &c, 0); } // this works on mostly white textures
 	//void replace_texture(const std::string& tex, std::string newfn)  { tref->set_multiply_color(tex, 0, &newfn); }
 	void assign_metaclass(uint8_t mclass)  { tref->klass->metaclass = mclass; }
+	uint32_t instance_id()  { return tref->instance_id; }
 
 	std::list<boost::weak_ptr<Household::Thingy>> sleep_list;
 	boost::python::list contact_list()
@@ -223,13 +261,62 @@ struct Camera {
 	void set_hfov(float hor_fov) { cref->camera_hfov = hor_fov; }
 	void set_near(float near)    { cref->camera_near = near; }
 	void set_far(float far)      { cref->camera_near = far; }
+	void set_fps(float fps)      { cref->camera_fps = fps; }
+	void set_modalities(bool rgb, bool depth, bool labeling)
+	{
+		cref->camera_modalities =
+			(cref->camera_modalities & (Household::CAMERA_POINTCLOUD|Household::CAMERA_INSTANCES)) |
+			(rgb ? Household::CAMERA_RGB : 0) |
+			(depth ? Household::CAMERA_DEPTH : 0) |
+			(labeling ? Household::CAMERA_LABELING : 0);
+	}
+	void set_pointcloud(bool enable, bool world_frame, bool float16)
+	{
+		cref->camera_modalities = (cref->camera_modalities & ~Household::CAMERA_POINTCLOUD) | (enable ? Household::CAMERA_POINTCLOUD : 0);
+		cref->camera_pointcloud_world = world_frame;
+		cref->camera_pointcloud_half = float16;
+		cref->render_ts = -1; // cached cloud might be in another frame or format
+	}
+	void set_instance_ids(bool enable)
+	{
+		cref->camera_modalities = (cref->camera_modalities & ~Household::CAMERA_INSTANCES) | (enable ? Household::CAMERA_INSTANCES : 0);
+	}
+	boost::python::object instance_ids()
+	{
+		if (cref->camera_instances.empty()) return object();
+		return make_tuple(
+			object(handle<>(PyBytes_FromStringAndSize(cref->camera_instances.c_str(), cref->camera_instances.size()))),
+			cref->camera_aux_w, cref->camera_aux_h);
+	}
+	boost::python::object pointcloud()
+	{
+		if (cref->camera_pointcloud.empty()) return object();
+		return make_tuple(
+			object(handle<>(PyBytes_FromStringAndSize(cref->camera_pointcloud.c_str(), cref->camera_pointcloud.size()))),
+			cref->camera_aux_w, cref->camera_aux_h,
+			cref->camera_pointcloud_half ? "float16" : "float32");
+	}
+	tuple render_stats()         { return make_tuple(cref->render_hits, cref->render_misses); }
+	void set_ssao_quality(int quality, bool temporal)
+	{
+		cref->camera_ssao_quality = ssao_quality_check(quality, "Camera.set_ssao_quality()");
+		cref->camera_ssao_temporal = temporal;
+	}
 
 	boost::python::object render(bool render_depth, bool render_labeling, bool print_timing)
 	{
+		TRACE_SPAN("py:Camera.render");
 		if (!app) app = app_create_as_needed(wref);
-		cref->camera_render(wref->cx, render_depth, render_labeling, print_timing);
+		uint32_t modalities = cref->camera_modalities;
+		if (render_depth) modalities |= Household::CAMERA_DEPTH;
+		if (render_labeling) modalities |= Household::CAMERA_LABELING;
+		render_depth = modalities & Household::CAMERA_DEPTH;
+		render_labeling = modalities & Household::CAMERA_LABELING;
+		bool render_rgb = modalities & Household::CAMERA_RGB;
+		if (!wref->camera_render_scheduler || !cref->camera_render_cached(wref.get(), modalities))
+			cref->camera_render(wref->cx, modalities, print_timing);
 		return make_tuple(
-				object(handle<>(PyBytes_FromStringAndSize(cref->camera_rgb.c_str(), cref->camera_rgb.size()))),
+				render_rgb ? object(handle<>(PyBytes_FromStringAndSize(cref->camera_rgb.c_str(), cref->camera_rgb.size()))) : object(),
 				render_depth ? object(handle<>(PyBytes_FromStringAndSize(cref->camera_depth.c_str(), cref->camera_depth.size()))) : object(),
 				render_depth ? object(handle<>(PyBytes_FromStringAndSize(cref->camera_depth_mask.c_str(), cref->camera_depth_mask.size()))) : object(),
 				render_labeling ? object(handle<>(PyBytes_FromStringAndSize(cref->camera_labeling.c_str(), cref->camera_labeling.size()))) : object(),
@@ -237,6 +324,27 @@ struct Camera {
 				);
 	}
 
+	void record_start(const std::string& fn)
+	{
+		if (!app) app = app_create_as_needed(wref);
+		cref->recorder.reset(); // finishes previous file
+		cref->recorder.reset(new SimpleRender::VideoRecorder(fn, cref->camera_res_w, cref->camera_res_h, cref->camera_fps, false));
+		cref->recorder_last_ts = -1;
+		bool listed = false;
+		for (const boost::weak_ptr<Household::Camera>& c: wref->recording_cameras)
+			listed |= c.lock()==cref;
+		if (!listed) wref->recording_cameras.push_back(cref); // recording_tick() renders each listed camera once
+	}
+
+	boost::python::object record_stop()
+	{
+		if (!cref->recorder) return object();
+		cref->recorder->finish();
+		tuple r = make_tuple(int(cref->recorder->frames_written), int(cref->recorder->frames_dropped));
+		cref->recorder.reset();
+		return r;
+	}
+
 	void move_and_look_at(float from_x, float from_y, float from_z, float obj_x, float obj_y, float obj_z)
 	{
 		Pose pose;
@@ -287,6 +395,23 @@ struct Robot {
 	void query_position()  { wref->query_body_position(rref); } // necessary for robot that is just created, before any step() done
 	void set_pose(const Pose& p)  { wref->robot_move(rref, p.convert_to_bt_transform(), btVector3(0,0,0)); }
 	void set_pose_and_speed(const Pose& p, float vx, float vy, float vz)  { wref->robot_move(rref, p.convert_to_bt_transform(), btVector3(vx,vy,vz)); }
+
+	void pd_joint_add(const Joint& j, float kp, float kd, float max_torque)  { rref->pd_joint_add(j.jref, kp, kd, max_torque); }
+	void pd_set_targets(const object& pos, const object& speed)
+	{
+		int n = rref->pd_joints.size();
+		FloatBuffer pb(pos, false, "target positions");
+		if (pb.floats() != n) throw std::runtime_error("Robot.pd_set_targets(): need " + std::to_string(n) + " target positions");
+		if (speed.is_none()) {
+			rref->pd_set_targets(pb.data(), 0);
+			return;
+		}
+		FloatBuffer sb(speed, false, "target speeds");
+		if (sb.floats() != n) throw std::runtime_error("Robot.pd_set_targets(): need " + std::to_string(n) + " target speeds");
+		rref->pd_set_targets(pb.data(), sb.data());
+	}
+	boost::python::list pd_torques()  { boost::python::list r; for (const Household::PdJoint& pj: rref->pd_joints) r.append(pj.last_torque); return r; }
+	void pd_clear()  { rref->pd_clear(); }
 	//void replace_texture(const std::string& material_name, const std::string& new_jpeg_png)  { rref->replace_texture(material_name, new_jpeg_png); }
 };
 
@@ -299,6 +424,7 @@ struct World {
 		wref.reset(new Household::World);
 		wref->bullet_init(gravity*SCALE, timestep);
 	}
+	World(const shared_ptr<Household::World>& wref): wref(wref)  { }
 
 	~World()
 	{
@@ -309,11 +435,13 @@ struct World {
 
 	Thingy load_thingy(const std::string& mesh_or_urdf_filename, const Pose& pose, double scale, double mass, int color, bool decoration_only)
 	{
+		TRACE_SPAN("py:World.load_thingy");
 		return Thingy(wref->load_thingy(mesh_or_urdf_filename, pose.convert_to_bt_transform(), scale*SCALE, mass, color, decoration_only), wref);
 	}
 
 	Robot load_urdf(const std::string& fn, const Pose& pose, bool fixed_base, bool self_collision)
 	{
+		TRACE_SPAN("py:World.load_urdf");
 		Robot r(wref->load_urdf(fn, pose.convert_to_bt_transform(), 1.0, fixed_base, self_collision), wref);
 		return r;
 	}
@@ -329,6 +457,7 @@ struct World {
 
 	boost::python::list load_mjcf(const std::string& fn)
 	{
+		TRACE_SPAN("py:World.load_mjcf");
 		std::list<shared_ptr<Household::Robot>> rlist = wref->load_sdf_mjcf(fn, true);
 		boost::python::list ret;
 		for (auto r: rlist)
@@ -353,8 +482,111 @@ struct World {
 
 	double ts()  { return wref->ts; }
 
+	boost::python::list robots()
+	{
+		boost::python::list r;
+		for (const boost::weak_ptr<Household::Robot>& w: wref->robotlist) {
+			shared_ptr<Household::Robot> robot = w.lock();
+			if (robot) r.append(Robot(robot, wref));
+		}
+		return r;
+	}
+
+	boost::python::list clone(int n)
+	{
+		TRACE_SPAN("py:World.clone");
+		boost::python::list r;
+		for (int i=0; i<n; i++) {
+			std::vector<shared_ptr<Household::Robot>> robots;
+			shared_ptr<Household::World> w = wref->clone(&robots);
+			boost::python::list rlist;
+			for (const shared_ptr<Household::Robot>& robot: robots)
+				rlist.append(Robot(robot, w));
+			r.append(make_tuple(World(w), rlist));
+		}
+		return r;
+	}
+
+	void copy_state_from(const World& src)
+	{
+		TRACE_SPAN("py:World.copy_state_from");
+		wref->state_copy_from(src.wref.get());
+	}
+
+	boost::python::dict instance_table()
+	{
+		boost::python::dict r;
+		for (const boost::weak_ptr<Household::Thingy>& w: wref->drawlist) {
+			shared_ptr<Household::Thingy> t = w.lock();
+			if (t && t->instance_id) r[t->instance_id] = Thingy(t, wref);
+		}
+		return r;
+	}
+
+	void set_gpu_resident_meshes(bool enable)  { wref->gpu_resident_meshes = enable; }
+
+	boost::python::dict mesh_memory()
+	{
+		size_t cpu_bytes, gpu_bytes, cpu_released_bytes;
+		wref->mesh_memory(&cpu_bytes, &gpu_bytes, &cpu_released_bytes);
+		boost::python::dict r;
+		r["cpu_bytes"] = cpu_bytes;
+		r["gpu_bytes"] = gpu_bytes;
+		r["cpu_released_bytes"] = cpu_released_bytes; // savings of gpu resident mode
+		return r;
+	}
+
+	boost::python::dict memory_report()
+	{
+		Household::MemoryReport m;
+		wref->memory_report(&m);
+		boost::python::dict r;
+		r["cpu_mesh"] = m.cpu_mesh;
+		r["cpu_mesh_released"] = m.cpu_mesh_released;
+		r["cpu_camera"] = m.cpu_camera;
+		r["cpu_lists"] = m.cpu_lists;
+		r["physics"] = m.physics;
+		r["gpu_buffers"] = m.gpu_buffers;
+		r["gpu_textures"] = m.gpu_textures;
+		r["gpu_framebuffers"] = m.gpu_framebuffers;
+		r["cpu_total"] = m.cpu_mesh + m.cpu_camera + m.cpu_lists + m.physics;
+		r["gpu_total"] = m.gpu_buffers + m.gpu_textures + m.gpu_framebuffers;
+		r["klasses"] = m.klasses;
+		r["shapes"] = m.shapes;
+		r["thingies"] = m.thingies;
+		r["robots"] = m.robots;
+		r["joints"] = m.joints;
+		r["cameras"] = m.cameras;
+		r["bullet_bodies"] = m.bullet_bodies;
+		return r;
+	}
+
+	void set_residency_budget(float gpu_mb, float cpu_mb)
+	{
+		wref->residency_budget_gpu = size_t(gpu_mb*1048576);
+		wref->residency_budget_cpu = size_t(cpu_mb*1048576);
+		if (wref->cx) wref->cx->residency_dirty = true;
+	}
+
+	boost::python::dict residency_stats()
+	{
+		boost::python::dict r;
+		if (!wref->cx) return r;
+		SimpleRender::Context* cx = wref->cx.get();
+		r["gpu_bytes"] = cx->residency_gpu_bytes;
+		r["cpu_bytes"] = cx->residency_cpu_bytes;
+		r["evicted_geometry"] = cx->residency_evicted_geometry;
+		r["evicted_textures"] = cx->residency_evicted_textures;
+		r["released_cpu"] = cx->residency_released_cpu;
+		r["reloaded_geometry"] = cx->residency_reloaded_geometry;
+		r["reloaded_textures"] = cx->residency_reloaded_textures;
+		r["render_target_bytes"] = cx->render_targets_bytes; // framebuffer pool, shared by viewports of equal size
+		return r;
+	}
+
 	bool step(int repeat)
 	{
+		TRACE_SPAN("py:World.step");
 		bool have_window = window && window->isVisible();
 		bool slowmo = wref->cx && wref->cx->slowmo && window && window->isVisible();
 		if (slowmo) {
@@ -378,8 +610,11 @@ struct World {
 			}
 			assert(counter==repeat);
 		} else {
-			wref->bullet_step(repeat);
-			if (app) {
+			{
+				GilRelease nogil;
+				wref->bullet_step(repeat);
+			}
+			if (app && window_frame_due()) {
 				app->process_events();
 				if (have_window) {
 					window->render_on_offscreen_surface();
@@ -388,6 +623,7 @@ struct World {
 			}
 		}
 
+		wref->recording_tick();
 		return false;
 	}
 
@@ -395,6 +631,140 @@ struct World {
 	shared_ptr<PythonKeyCallback> cb;
 	int ms_countdown = 0;
 
+	// Test window is redrawn at most window_fps times per second, steps in between
+	// don't touch Qt at all, so simulation runs at full speed with window open.
+	int window_fps = 30;
+	QElapsedTimer window_frame_timer;
+	bool window_frame_due()
+	{
+		if (window_fps <= 0) return true; // every step, old behavior
+		if (window_frame_timer.isValid() && window_frame_timer.elapsed() < 1000/window_fps)
+			return false;
+		window_frame_timer.start();
+		return true;
+	}
+	void set_test_window_fps(int fps)  { window_fps = fps; }
+
+	int  test_window_ssao_quality = Household::SSAO_FULL;
+	bool test_window_ssao_temporal = false;
+	void set_test_window_ssao_quality(int quality, bool temporal)
+	{
+		test_window_ssao_quality = ssao_quality_check(quality, "set_test_window_ssao_quality()");
+		test_window_ssao_temporal = temporal;
+		if (window) {
+			window->ssao_quality = quality;
+			window->ssao_temporal = temporal;
+		}
+	}
+
+	void set_camera_render_scheduler(bool enable)  { wref->camera_render_scheduler = enable; }
+
+	boost::python::dict metrics()
+	{
+		boost::python::dict r;
+		for (int i=0; i<Household::METRIC_COUNT; i++) {
+			const Household::LatencyHistogram& h = wref->metrics.hist[i];
+			boost::python::dict d;
+			d["count"]    = h.count;
+			d["total_ms"] = h.sum_ns / 1e6;
+			d["mean_us"]  = h.count ? h.sum_ns / 1e3 / h.count : 0.0;
+			d["min_us"]   = h.count ? h.min_ns / 1e3 : 0.0;
+			d["max_us"]   = h.max_ns / 1e3;
+			d["p50_us"]   = h.percentile_ns(50) / 1e3;
+			d["p90_us"]   = h.percentile_ns(90) / 1e3;
+			d["p99_us"]   = h.percentile_ns(99) / 1e3;
+			r[Household::metric_names[i]] = d;
+		}
+		for (int i=0; i<Household::COUNTER_COUNT; i++)
+			r[Household::counter_names[i]] = wref->metrics.counters[i];
+		return r;
+	}
+
+	boost::python::list metrics_histogram(const std::string& name)
+	{
+		for (int i=0; i<Household::METRIC_COUNT; i++) {
+			if (name != Household::metric_names[i]) continue;
+			const Household::LatencyHistogram& h = wref->metrics.hist[i];
+			boost::python::list r;
+			for (int b=0; b<Household::LatencyHistogram::BUCKETS; b++)
+				if (h.buckets[b]) r.append(make_tuple(Household::LatencyHistogram::bucket_top(b) / 1e3, h.buckets[b]));
+			return r;
+		}
+		throw std::runtime_error("metrics_histogram(): no metric '" + name + "'");
+	}
+
+	void metrics_reset()  { wref->metrics.reset(); }
+
+	void start_trace(const std::string& path, bool bullet_internals)
+	{
+		Household::trace_start(path);
+		if (bullet_internals) wref->bullet_trace_start(path + ".bullet.json");
+	}
+	void start_trace_path(const std::string& path)  { start_trace(path, false); }
+
+	int stop_trace()
+	{
+		wref->bullet_trace_stop();
+		return Household::trace_stop();
+	}
+
+	void render_cameras_rgb(const boost::python::list& cameras, const boost::python::list& buffers)
+	{
+		TRACE_SPAN("py:World.render_cameras_rgb");
+		if (!app) app = app_create_as_needed(wref);
+		int n = len(cameras);
+		if (len(buffers) != n) throw std::runtime_error("render_cameras_rgb(): need one buffer per camera");
+		std::vector<shared_ptr<Household::Camera>> cams;
+		std::vector<uint8_t*> dst;
+		std::vector<Py_buffer> views(n);
+		int got = 0;
+		try {
+			for (int i=0; i<n; i++) {
+				shared_ptr<Household::Camera> c = extract<Camera&>(cameras[i])().cref;
+				if (PyObject_GetBuffer(object(buffers[i]).ptr(), &views[i], PyBUF_WRITABLE|PyBUF_C_CONTIGUOUS) != 0)
+					throw_error_already_set();
+				got++;
+				if (views[i].len != 3*c->camera_res_w*c->camera_res_h)
+					throw std::runtime_error("render_cameras_rgb(): buffer for camera '" + c->camera_name + "' must be exactly " +
+						std::to_string(3*c->camera_res_w*c->camera_res_h) + " bytes");
+				cams.push_back(c);
+				dst.push_back((uint8_t*) views[i].buf);
+			}
+			wref->cameras_render_rgb(cams, dst);
+		} catch (...) {
+			for (int i=0; i<got; i++) PyBuffer_Release(&views[i]);
+			throw;
+		}
+		for (int i=0; i<got; i++) PyBuffer_Release(&views[i]);
+	}
+
+	boost::python::dict ssao_stats()
+	{
+		boost::python::dict r;
+		if (!wref->cx) return r;
+		const char* names[4] = { "off", "half", "full", "reused" };
+		for (int i=0; i<4; i++) {
+			int frames = wref->cx->ssao_tier_frames[i];
+			r[names[i]] = make_tuple(frames, frames ? wref->cx->ssao_tier_ms[i] / frames : 0.0); // (frames, mean GPU ms per frame)
+		}
+		return r;
+	}
+
+	void test_window_record_start(const std::string& fn)
+	{
+		if (!window) throw std::runtime_error("test_window_record_start(): no test window, call test_window() first");
+		window->record_start(fn, window_fps > 0 ? window_fps : 60);
+	}
+
+	boost::python::object test_window_record_stop()
+	{
+		if (!window || !window->recorder) return object();
+		window->recorder->finish();
+		tuple r = make_tuple(int(window->recorder->frames_written), int(window->recorder->frames_dropped));
+		window->recorder.reset();
+		return r;
+	}
+
 	bool test_window()
 	{
 		if (!app) app = app_create_as_needed(wref);
@@ -421,6 +791,8 @@ struct World {
 		}
 		window = new Viz(wref->cx);
 		window->key_callback = cb;
+		window->ssao_quality = test_window_ssao_quality;
+		window->ssao_temporal = test_window_ssao_temporal;
 		window->wheel /= SCALE;
 		QDesktopWidget* desk = QApplication::desktop();
 		qreal rat = desk->windowHandle()->devicePixelRatio();
@@ -498,9 +870,9 @@ struct World {
 	void test_window_history_reset()
 	{
 		if (!window) return;
-		window->reward_hist.resize(0);
-		window->action_hist.resize(0);
-		window->obs_hist.resize(0);
+		window->reward_hist.reset(0);
+		window->action_hist.reset(0);
+		window->obs_hist.reset(0);
 	}
 
 	Camera new_camera_free_float(
@@ -510,6 +882,8 @@ struct World {
 		cam->camera_name = camera_name;
 		cam->camera_res_w = camera_res_w;
 		cam->camera_res_h = camera_res_h;
+		wref->cameras.remove_if([](const boost::weak_ptr<Household::Camera>& c) { return c.expired(); }); // envs make new camera on each reset
+		wref->cameras.push_back(cam);
 		return Camera(cam, wref);
 	}
 
@@ -572,6 +946,277 @@ Pose tip_y(float x, float y, float z, float yaw)
 }
 
 
+static object shm_view(void* p, size_t bytes)  { return object(handle<>(PyMemoryView_FromMemory((char*) p, bytes, PyBUF_WRITE))); }
+
+struct SharedMemoryGame {
+	shared_ptr<Household::SharedMemoryGame> g;
+	SharedMemoryGame(const std::string& guid, int players, int obs_max, int act_max, int rgb_max): g(new Household::SharedMemoryGame(guid, players, obs_max, act_max, rgb_max))  { }
+	SharedMemoryGame(const std::string& guid, int timeout_ms): g(new Household::SharedMemoryGame(guid, timeout_ms))  { }
+
+	int players()  { return g->players(); }
+	void set_env_id(int player, const std::string& env_id)
+	{
+		Household::ShmSlot* s = g->slot(player);
+		snprintf(s->env_id, sizeof(s->env_id), "%s", env_id.c_str());
+	}
+	std::string env_id(int player)  { return g->slot(player)->env_id; }
+	void set_sizes(int player, int obs_n, int act_n, int rgb_w, int rgb_h)
+	{
+		if (obs_n > g->header->obs_max || act_n > g->header->act_max || 3*rgb_w*rgb_h > g->header->rgb_max)
+			throw std::runtime_error("multiplayer: observation, action or image doesn't fit into shared memory slot, increase limits on server");
+		Household::ShmSlot* s = g->slot(player);
+		s->obs_n = obs_n;
+		s->act_n = act_n;
+		s->rgb_w = rgb_w;
+		s->rgb_h = rgb_h;
+	}
+	tuple sizes(int player)  { Household::ShmSlot* s = g->slot(player); return make_tuple(s->obs_n, s->act_n, s->rgb_w, s->rgb_h); }
+
+	// Views into shared memory, valid while this object exists
+	object obs(int player)  { return shm_view(g->obs(player), sizeof(float)*g->slot(player)->obs_n); }
+	object act(int player)  { return shm_view(g->act(player), sizeof(float)*g->slot(player)->act_n); }
+	object rgb(int player)  { Household::ShmSlot* s = g->slot(player); return shm_view(g->rgb(player), 3*s->rgb_w*s->rgb_h); }
+	float rew(int player)  { return g->slot(player)->rew; }
+	void set_rew(int player, float r)  { g->slot(player)->rew = r; }
+
+	std::string request(int player, const std::string& cmd, int timeout_ms)
+	{
+		if (cmd.size() != 1) throw std::runtime_error("multiplayer: command is one character");
+		uint32_t resp;
+		PyThreadState* save = PyEval_SaveThread(); // other python threads can work while we wait
+		resp = g->client_request(player, cmd[0], timeout_ms);
+		PyEval_RestoreThread(save);
+		return resp ? std::string(1, char(resp)) : std::string();
+	}
+	std::string wait_command(int player, int timeout_ms)
+	{
+		uint32_t cmd;
+		PyThreadState* save = PyEval_SaveThread();
+		cmd = g->server_wait(player, timeout_ms);
+		PyEval_RestoreThread(save);
+		return cmd ? std::string(1, char(cmd)) : std::string();
+	}
+	void respond(int player, const std::string& resp)
+	{
+		if (resp.size() != 1) throw std::runtime_error("multiplayer: response is one character");
+		g->server_respond(player, resp[0]);
+	}
+
+	void step_begin(int deadline_ms)  { g->step_begin(deadline_ms); }
+	int wait_any(const boost::python::list& players)
+	{
+		std::vector<int> v;
+		for (int i=0; i<len(players); i++) v.push_back(extract<int>(players[i]));
+		int r;
+		PyThreadState* save = PyEval_SaveThread();
+		r = g->wait_any(v);
+		PyEval_RestoreThread(save);
+		return r;
+	}
+	int poll_any(const boost::python::list& players)
+	{
+		std::vector<int> v;
+		for (int i=0; i<len(players); i++) v.push_back(extract<int>(players[i]));
+		return g->poll_any(v);
+	}
+	void stragglers(const boost::python::list& players)
+	{
+		std::vector<int> v;
+		for (int i=0; i<len(players); i++) v.push_back(extract<int>(players[i]));
+		g->stragglers(v);
+	}
+	boost::python::list latency_stats()
+	{
+		boost::python::list r;
+		for (const Household::PlayerLatency& l: g->latency) {
+			boost::python::dict d;
+			d["count"] = l.count;
+			d["mean_us"] = l.count ? l.sum_us / l.count : 0.0;
+			d["max_us"] = l.max_us;
+			d["late"] = l.late;
+			r.append(d);
+		}
+		return r;
+	}
+};
+
+struct MlpPolicy {
+	shared_ptr<Household::MlpPolicy> pref;
+	MlpPolicy(): pref(new Household::MlpPolicy)  { }
+
+	void layer_add(const object& w, const object& b, bool relu)
+	{
+		FloatBuffer wb(w, false, "weights");
+		FloatBuffer bb(b, false, "biases");
+		if (wb.view.ndim != 2 || bb.floats() != wb.dim(1))
+			throw std::runtime_error("MlpPolicy.layer_add(): need weights of shape (in, out) and biases of shape (out,)");
+		pref->layer_add(wb.dim(0), wb.dim(1), wb.data(), bb.data(), relu);
+	}
+	int obs_n()  { return pref->obs_n(); }
+	int act_n()  { return pref->act_n(); }
+	int bytes()  { return int(pref->bytes()); }
+
+	int act(const object& obs, const object& act)
+	{
+		TRACE_SPAN("py:MlpPolicy.act");
+		FloatBuffer ob(obs, false, "observations");
+		FloatBuffer ab(act, true, "actions");
+		int on = pref->obs_n();
+		if (on==0 || ob.floats() % on) throw std::runtime_error("MlpPolicy.act(): observations size is not a multiple of " + std::to_string(on));
+		int batch = ob.floats() / on;
+		if (ab.floats() != batch*pref->act_n()) throw std::runtime_error("MlpPolicy.act(): actions must be " + std::to_string(batch*pref->act_n()) + " floats");
+		PyThreadState* save = PyEval_SaveThread();
+		pref->act(ob.data(), batch, ab.data());
+		PyEval_RestoreThread(save);
+		return batch;
+	}
+};
+
+struct BotPlayer {
+	shared_ptr<Household::BotPlayer> bref;
+	BotPlayer(const MlpPolicy& policy): bref(new Household::BotPlayer)  { bref->policy = policy.pref; }
+
+	void obs_joint_add(const Joint& j, float pos_mul, float speed_mul)  { bref->obs_joints.push_back(Household::BotObsJoint{ j.jref, pos_mul, speed_mul }); }
+	void act_joint_add(const Joint& j, float scale, float kd, float maxforce)  { bref->act_joints.push_back(Household::BotActJoint{ j.jref, scale, kd, maxforce }); }
+	void set_obs_extra(const boost::python::list& extra)
+	{
+		bref->obs_extra.resize(len(extra));
+		for (int i=0; i<(int)bref->obs_extra.size(); i++) bref->obs_extra[i] = extract<float>(extra[i]);
+	}
+	boost::python::list obs()  { boost::python::list r; for (float x: bref->obs) r.append(x); return r; }
+	boost::python::list act()  { boost::python::list r; for (float x: bref->act) r.append(x); return r; }
+};
+
+static void world_bots_step(World& w, const boost::python::list& bots)
+{
+	TRACE_SPAN("py:World.bots_step");
+	std::vector<shared_ptr<Household::BotPlayer>> v;
+	for (int i=0; i<len(bots); i++) v.push_back(extract<BotPlayer&>(bots[i])().bref);
+	Household::bots_step(v);
+}
+
+// Robots in one batch can come from different worlds (World.clone()), each is computed in its own world
+static std::vector<Robot> dynamics_batch(const boost::python::list& robots, int* dofs, const std::string& fname)
+{
+	std::vector<Robot> v;
+	for (int i=0; i<len(robots); i++) v.push_back(extract<Robot&>(robots[i])());
+	*dofs = v.empty() ? 0 : Household::robot_dofs(v[0].rref.get());
+	for (const Robot& r: v)
+		if (Household::robot_dofs(r.rref.get()) != *dofs)
+			throw std::runtime_error(fname + "(): all robots must have the same number of joints");
+	return v;
+}
+
+static void world_inverse_dynamics(World& w, const boost::python::list& robots, const object& qddot, const object& out)
+{
+	TRACE_SPAN("py:World.inverse_dynamics");
+	int dofs;
+	std::vector<Robot> v = dynamics_batch(robots, &dofs, "inverse_dynamics");
+	FloatBuffer ab(qddot, false, "qddot");
+	FloatBuffer ob(out, true, "out");
+	int need = v.size()*dofs;
+	if (ab.floats() != need || ob.floats() != need)
+		throw std::runtime_error("inverse_dynamics(): qddot and out must be " + std::to_string(v.size()) + "x" + std::to_string(dofs));
+	for (size_t i=0; i<v.size(); i++)
+		Household::robot_inverse_dynamics(v[i].wref.get(), v[i].rref.get(), ab.data() + i*dofs, ob.data() + i*dofs);
+}
+
+static void world_mass_matrices(World& w, const boost::python::list& robots, const object& out)
+{
+	TRACE_SPAN("py:World.mass_matrices");
+	int dofs;
+	std::vector<Robot> v = dynamics_batch(robots, &dofs, "mass_matrices");
+	FloatBuffer ob(out, true, "out");
+	if (ob.floats() != int(v.size())*dofs*dofs)
+		throw std::runtime_error("mass_matrices(): out must be " + std::to_string(v.size()) + "x" + std::to_string(dofs) + "x" + std::to_string(dofs));
+	for (size_t i=0; i<v.size(); i++)
+		Household::robot_mass_matrix(v[i].wref.get(), v[i].rref.get(), ob.data() + i*dofs*dofs);
+}
+
+static void world_jacobians(World& w, const boost::python::list& parts, const object& lin, const object& ang)
+{
+	TRACE_SPAN("py:World.jacobians");
+	std::vector<Thingy> v;
+	std::vector<shared_ptr<Household::Robot>> robots;
+	int dofs = 0;
+	for (int i=0; i<len(parts); i++) {
+		Thingy t = extract<Thingy&>(parts[i])();
+		auto f = t.wref->bullet_handle_to_robot.find(t.tref->bullet_handle);
+		shared_ptr<Household::Robot> r;
+		if (f != t.wref->bullet_handle_to_robot.end()) r = f->second.lock();
+		if (!r) throw std::runtime_error("jacobians(): '" + t.tref->name + "' is not a part of live robot");
+		int d = Household::robot_dofs(r.get());
+		if (i > 0 && d != dofs) throw std::runtime_error("jacobians(): all robots must have the same number of joints");
+		dofs = d;
+		v.push_back(t);
+		robots.push_back(r);
+	}
+	FloatBuffer lb(lin, true, "lin");
+	FloatBuffer ab(ang, true, "ang");
+	int need = v.size()*3*dofs;
+	if (lb.floats() != need || ab.floats() != need)
+		throw std::runtime_error("jacobians(): lin and ang must be " + std::to_string(v.size()) + "x3x" + std::to_string(dofs));
+	for (size_t i=0; i<v.size(); i++)
+		Household::robot_jacobian(v[i].wref.get(), robots[i].get(), v[i].tref->bullet_link_n, lb.data() + i*3*dofs, ab.data() + i*3*dofs);
+}
+
+struct RolloutActions {
+	shared_ptr<Household::RolloutActions> aref;
+	RolloutActions(int frame_skip): aref(new Household::RolloutActions)  { aref->frame_skip = frame_skip; }
+
+	void joint_add(const Joint& j, float scale)  { aref->joints.push_back(Household::RolloutActJoint{ j.jref, scale }); }
+	void set(const object& actions)
+	{
+		FloatBuffer ab(actions, false, "actions");
+		aref->actions.assign(ab.data(), ab.data() + ab.floats());
+	}
+};
+
+struct RolloutPredicate {
+	shared_ptr<Household::RolloutPredicate> pref;
+	shared_ptr<Household::Thingy> nopart;
+	shared_ptr<Household::Joint> nojoint;
+	RolloutPredicate(): pref(new Household::RolloutPredicate)  { }
+
+	void add(int type, const shared_ptr<Household::Thingy>& part, const shared_ptr<Household::Joint>& joint, float threshold, uint8_t metaclass)
+	{
+		Household::RolloutCondition c;
+		c.type = type;
+		c.part = part;
+		c.joint = joint;
+		c.threshold = threshold;
+		c.metaclass = metaclass;
+		pref->any.push_back(c);
+	}
+	void z_below(const Thingy& t, float z)  { add(Household::RolloutCondition::Z_BELOW, t.tref, nojoint, z, 0); }
+	void z_above(const Thingy& t, float z)  { add(Household::RolloutCondition::Z_ABOVE, t.tref, nojoint, z, 0); }
+	void abs_pitch_above(const Thingy& t, float a)  { add(Household::RolloutCondition::ABS_PITCH_ABOVE, t.tref, nojoint, a, 0); }
+	void abs_roll_above(const Thingy& t, float a)   { add(Household::RolloutCondition::ABS_ROLL_ABOVE, t.tref, nojoint, a, 0); }
+	void joint_at_limit(const Joint& j, float margin)  { add(Household::RolloutCondition::JOINT_AT_LIMIT, nopart, j.jref, margin, 0); }
+	void contact(const Thingy& t, uint8_t metaclass)  { add(Household::RolloutCondition::CONTACT_METACLASS, t.tref, nojoint, 0, metaclass); }
+	void contact_name(const Thingy& t, const std::string& name)
+	{
+		add(Household::RolloutCondition::CONTACT_NAME, t.tref, nojoint, 0, 0);
+		pref->any.back().other_name = name;
+	}
+	int conditions()  { return pref->any.size(); }
+};
+
+static tuple world_rollout(World& w, int k, const RolloutActions& actions, const RolloutPredicate& predicate)
+{
+	TRACE_SPAN("py:World.rollout");
+	int stopped_by;
+	int steps;
+	if (w.wref->recording_cameras.empty()) {
+		GilRelease nogil;
+		steps = Household::rollout(w.wref.get(), k, *actions.aref, *predicate.pref, &stopped_by);
+	} else {
+		// recording_tick() renders on shared GL context, other python threads must not use it meanwhile
+		steps = Household::rollout(w.wref.get(), k, *actions.aref, *predicate.pref, &stopped_by);
+	}
+	return make_tuple(steps, stopped_by);
+}
+
 void sanity_checks()
 {
 	float t;
@@ -635,6 +1280,7 @@ void cpp_household_init()
 	.def("set_multiply_color", &Thingy::set_multiply_color)
 	//.def("replace_texture", &Thingy::replace_texture)
 	.def("assign_metaclass", &Thingy::assign_metaclass)  // assigns to class, not to instance
+	.add_property("instance_id", &Thingy::instance_id)    // value in Camera.instance_ids(), 0 if never drawn
 	;
 
 	class_<Camera>("Camera", no_init)
@@ -647,8 +1293,18 @@ void cpp_household_init()
 	.def("set_hfov", &Camera::set_hfov)
 	.def("set_near", &Camera::set_near)
 	.def("set_far", &Camera::set_far)
+	.def("set_fps", &Camera::set_fps)
+	.def("set_modalities", &Camera::set_modalities)  // (rgb, depth, labeling) always rendered; rgb=False makes depth/labeling only pipelines
+	.def("set_pointcloud", &Camera::set_pointcloud)  // (enable, world_frame, float16) computed on GPU with each render()
+	.def("set_instance_ids", &Camera::set_instance_ids)  // render Thingy.instance_id per pixel with each render(), see World.instance_table()
+	.def("instance_ids", &Camera::instance_ids)          // (bytes, w, h) of last render(), uint32 per pixel, 0 nothing hit
+	.def("pointcloud", &Camera::pointcloud)          // (bytes, w, h, dtype) of last render(), 4 values per point: x y z label; label -1 no hit
+	.def("render_stats", &Camera::render_stats)  // (cache hits, misses) of render scheduler
+	.def("set_ssao_quality", &Camera::set_ssao_quality) // same as World.set_test_window_ssao_quality()
 	.def("set_pose", &Camera::set_pose)
 	.def("move_and_look_at", &Camera::move_and_look_at)  // same as set_pose(), only sets camera position and orientation
+	.def("record_start", &Camera::record_start)  // .y4m file, frames taken every 1/camera_fps of world time
+	.def("record_stop", &Camera::record_stop)    // returns (frames_written, frames_dropped)
 	;
 
 	class_<Joint>("Joint", no_init)
@@ -672,6 +1328,10 @@ void cpp_household_init()
 	.def("set_pose", &Robot::set_pose)
 	.def("set_pose_and_speed", &Robot::set_pose_and_speed)
 	.def("query_position", &Robot::query_position)
+	.def("pd_joint_add", &Robot::pd_joint_add)      // (joint, kp, kd, max_torque) PD torque recomputed at every physics substep, gains set once
+	.def("pd_set_targets", &Robot::pd_set_targets)  // (positions, speeds or None) float32 buffers, one value per pd_joint_add() call, in that order
+	.def("pd_torques", &Robot::pd_torques)          // torques applied at last substep, after clipping
+	.def("pd_clear", &Robot::pd_clear)
     .def("pose", &Robot::pose)
     .def("speed", &Robot::speed)
 	//.def("replace_texture", &Robot::replace_texture)
@@ -686,10 +1346,37 @@ void cpp_household_init()
 	.def("new_camera_free_float", &World::new_camera_free_float)
 	.def("step", &World::step)
 	.add_property("ts", &World::ts)
+	.def("robots", &World::robots)  // live robots in load order
+	.def("clone", &World::clone)    // (n) [(world, robots), ...] n worlds with own bullet, same bodies, state and controls; robots in same order as robots(); shapes are shared, no rendering in clones
+	.def("copy_state_from", &World::copy_state_from)  // (world) positions, speeds, controls and ts of world with same loads, reuses a clone for next branch without loading
+	.def("set_gpu_resident_meshes", &World::set_gpu_resident_meshes)
+	.def("mesh_memory", &World::mesh_memory)
+	.def("memory_report", &World::memory_report)  // bytes by category and object counts, cheap enough for each episode, compare across clean_everything() to find leaks
+	.def("set_residency_budget", &World::set_residency_budget)
+	.def("instance_table", &World::instance_table)  // {instance_id: Thingy} for Camera.instance_ids()
+	.def("residency_stats", &World::residency_stats)
 	.def("test_window", &World::test_window)
 	.def("test_window_print", &World::test_window_print)
 	.def("test_window_billboard", &World::test_window_billboard)
 	.def("test_window_big_caption", &World::test_window_big_caption)
+	.def("set_test_window_fps", &World::set_test_window_fps)
+	.def("set_test_window_ssao_quality", &World::set_test_window_ssao_quality) // 0 off, 1 half resolution, 2 full; temporal reuses AO while camera is still
+	.def("ssao_stats", &World::ssao_stats)
+	.def("metrics", &World::metrics)                      // {phase: {count, total_ms, mean_us, min_us, max_us, p50_us, p90_us, p99_us}, counter: value}
+	.def("metrics_histogram", &World::metrics_histogram)  // (phase) [(bucket_top_us, count), ...] nonempty buckets
+	.def("metrics_reset", &World::metrics_reset)          // call on episode start to get per episode numbers
+	.def("start_trace", &World::start_trace_path)
+	.def("start_trace", &World::start_trace)  // (path, bullet_internals=False) spans of all worlds and threads, open in chrome://tracing; bullet own profile goes to path+".bullet.json"
+	.def("stop_trace", &World::stop_trace)    // writes file, returns number of spans
+	.def("rollout", &world_rollout)  // (k, RolloutActions, RolloutPredicate) up to k steps in C++, returns (steps_done, index of condition that stopped it or -1)
+	.def("inverse_dynamics", &world_inverse_dynamics)  // ([robot, ...], qddot, out) float32 n x joints each: torques for accelerations qddot at current position and speed, fixed base robots only
+	.def("mass_matrices", &world_mass_matrices)        // ([robot, ...], out) float32 n x joints x joints
+	.def("jacobians", &world_jacobians)                // ([part, ...], lin, ang) float32 n x 3 x joints each, world frame, at part center of mass
+	.def("bots_step", &world_bots_step)  // ([BotPlayer, ...]) observe, evaluate policies batched, apply actions, all in C++
+	.def("render_cameras_rgb", &World::render_cameras_rgb)  // render_cameras_rgb([camera, ...], [writable buffer, ...]): rgb of all cameras in one batch, written into buffers
+	.def("set_camera_render_scheduler", &World::set_camera_render_scheduler) // Camera.render() returns cached frame if camera_fps interval didn't pass, or nothing moved
+	.def("test_window_record_start", &World::test_window_record_start)
+	.def("test_window_record_stop", &World::test_window_record_stop)   // returns (frames_written, frames_dropped)
 	.def("test_window_observations", &World::test_window_observations)
 	.def("test_window_rewards", &World::test_window_rewards)
 	.def("test_window_actions", &World::test_window_actions)
@@ -705,6 +1392,60 @@ void cpp_household_init()
 	.def("set_glsl_path", &World::set_glsl_path)
 	;
 
+	class_<SharedMemoryGame>("SharedMemoryGame", init<std::string,int,int,int,int>()) // server: (game_server_guid, players, obs_max, act_max, rgb_max_bytes)
+	.def(init<std::string,int>())                          // client: (game_server_guid, timeout_ms) waits for server to create game
+	.add_property("players", &SharedMemoryGame::players)
+	.def("set_env_id", &SharedMemoryGame::set_env_id)
+	.def("env_id", &SharedMemoryGame::env_id)
+	.def("set_sizes", &SharedMemoryGame::set_sizes)        // server: (player, obs_n, act_n, rgb_w, rgb_h) after env is created
+	.def("sizes", &SharedMemoryGame::sizes)
+	.def("obs", &SharedMemoryGame::obs)                    // writable memoryview, np.frombuffer(..., dtype=np.float32)
+	.def("act", &SharedMemoryGame::act)
+	.def("rgb", &SharedMemoryGame::rgb)
+	.def("rew", &SharedMemoryGame::rew)
+	.def("set_rew", &SharedMemoryGame::set_rew)
+	.def("request", &SharedMemoryGame::request)            // client: (player, cmd, timeout_ms) returns response, "" on timeout; -1 waits forever
+	.def("wait_command", &SharedMemoryGame::wait_command)  // server: (player, timeout_ms) returns command, "" on timeout
+	.def("respond", &SharedMemoryGame::respond)            // server: (player, resp) completes command
+	.def("step_begin", &SharedMemoryGame::step_begin)      // server: (deadline_ms) for wait_any() in this step, -1 none
+	.def("wait_any", &SharedMemoryGame::wait_any)          // server: ([players]) one with pending command, -1 after deadline
+	.def("poll_any", &SharedMemoryGame::poll_any)          // server: ([players]) one with pending command, -1 right away if none
+	.def("stragglers", &SharedMemoryGame::stragglers)      // server: ([players]) stepped without their action
+	.def("latency_stats", &SharedMemoryGame::latency_stats) // server: per player {count, mean_us, max_us, late}, response to next request as client posted it
+	;
+
+	class_<MlpPolicy>("MlpPolicy")
+	.def("layer_add", &MlpPolicy::layer_add)   // (weights, biases, relu) float32 arrays (in, out) and (out,), as in agent_zoo
+	.add_property("obs_n", &MlpPolicy::obs_n)
+	.add_property("act_n", &MlpPolicy::act_n)
+	.add_property("bytes", &MlpPolicy::bytes)
+	.def("act", &MlpPolicy::act)               // (obs, act) float32 buffers, batch*obs_n in, batch*act_n written; returns batch
+	;
+
+	class_<BotPlayer>("BotPlayer", init<const MlpPolicy&>())
+	.def("obs_joint_add", &BotPlayer::obs_joint_add)   // (joint, pos_mul, speed_mul) observation gets two values, in order of calls
+	.def("act_joint_add", &BotPlayer::act_joint_add)   // (joint, scale, kd, maxforce) action i is target speed for joint i
+	.def("set_obs_extra", &BotPlayer::set_obs_extra)   // ([values]) appended after joint values
+	.def("obs", &BotPlayer::obs)                       // last observation and action, for debugging
+	.def("act", &BotPlayer::act)
+	;
+
+	class_<RolloutActions>("RolloutActions", init<int>())  // (frame_skip)
+	.def("joint_add", &RolloutActions::joint_add)  // (joint, scale) action i is torque scale*clip(a[i], -1, +1) for joint i
+	.def("set", &RolloutActions::set)              // (float32 buffer) one action held for all steps, or k actions one per step
+	;
+
+	class_<RolloutPredicate>("RolloutPredicate")   // true when any of conditions is true, checked after each step
+	.def("z_below", &RolloutPredicate::z_below)    // (part, z)
+	.def("z_above", &RolloutPredicate::z_above)
+	.def("abs_pitch_above", &RolloutPredicate::abs_pitch_above)  // (part, radians) as in Pose.rpy()
+	.def("abs_roll_above", &RolloutPredicate::abs_roll_above)
+	.def("joint_at_limit", &RolloutPredicate::joint_at_limit)    // (joint, margin) closer than margin to either limit
+	.def("contact", &RolloutPredicate::contact)    // (part, metaclass) touches part of that metaclass, 0 is anything
+	.def("contact_name", &RolloutPredicate::contact_name)  // (part, name) touches part with that name, such as "floor"
+	.add_property("conditions", &RolloutPredicate::conditions)
+	;
+
 	scope().attr("tip_z") = tip_z;
 	scope().attr("tip_y") = tip_y;
 	scope().attr("COLLISION_MARGIN") = Household::COLLISION_MARGIN/SCALE;
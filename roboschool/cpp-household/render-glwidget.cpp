@@ -3,6 +3,7 @@
 
 #include <QtOpenGL/QtOpenGL>
 #include <QtGui/QKeyEvent>
+#include <algorithm>
 
 using boost::shared_ptr;
 using namespace SimpleRender;
@@ -25,10 +26,52 @@ void Viz::initializeGL()
 {
 }
 
-void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, bool render_depth, bool render_labeling, bool print_timing)
+const int RGB_OVERSAMPLING = 1; // change me to see the difference (good values 0 1 2)
+const int AUX_OVERSAMPLING = 2;
+
+// glReadPixels() result of (dw << RGB_OVERSAMPLING, dh << RGB_OVERSAMPLING) rgb, rows bottom to top => dw*dh rgb top to bottom
+static void rgb_downsample(const uint8_t* tmp, int dw, int dh, uint8_t* dst, std::vector<uint16_t>* scratch)
+{
+	int ow = dw << RGB_OVERSAMPLING;
+	int oh = dh << RGB_OVERSAMPLING;
+	if (RGB_OVERSAMPLING==0) {
+		for (int y=0; y<oh; ++y)
+			memcpy(&dst[y*3*ow], &tmp[(oh-1-y)*3*ow], 3*ow);
+		return;
+	}
+	scratch->assign(3*dw*dh, 0);
+	uint16_t* acc = scratch->data();
+	int rs = 3*dw;
+	for (int oy=0; oy<oh; oy++) {
+		int dy = oy >> RGB_OVERSAMPLING;
+		const uint8_t* src = &tmp[(oh-1-oy)*3*ow];
+		for (int ox=0; ox<ow; ox++) {
+			int dx = ox >> RGB_OVERSAMPLING;
+			acc[dy*rs + 3*dx + 0] += src[3*ox + 0];
+			acc[dy*rs + 3*dx + 1] += src[3*ox + 1];
+			acc[dy*rs + 3*dx + 2] += src[3*ox + 2];
+		}
+	}
+	for (int t=0; t<3*dw*dh; t++)
+		dst[t] = acc[t] >> (RGB_OVERSAMPLING+RGB_OVERSAMPLING);
+}
+
+static void read_pixels(Metrics* metrics, int w, int h, GLenum format, GLenum type, void* dst, size_t bytes)
 {
-	const int RGB_OVERSAMPLING = 1; // change me to see the difference (good values 0 1 2)
-	const int AUX_OVERSAMPLING = 2;
+	MetricsTimer mt(metrics, METRIC_READBACK);
+	TRACE_SPAN("glReadPixels");
+	glReadPixels(0, 0, w, h, format, type, dst);
+	if (metrics) metrics->count(COUNTER_READBACK_BYTES, bytes);
+}
+
+void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, uint32_t modalities, bool print_timing)
+{
+	TRACE_SPAN("camera_render");
+	bool render_rgb      = modalities & CAMERA_RGB;
+	bool render_depth    = modalities & CAMERA_DEPTH;
+	bool render_labeling = modalities & CAMERA_LABELING;
+	bool render_pointcloud = modalities & CAMERA_POINTCLOUD;
+	bool render_instances  = modalities & CAMERA_INSTANCES;
 
 	int dw = camera_res_w;
 	int dh = camera_res_h;
@@ -42,6 +85,10 @@ void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, bool ren
 		viewport.reset(new SimpleRender::ContextViewport(cx, ow, oh, camera_near, camera_far, camera_hfov));
 		CHECK_GL_ERROR;
 	}
+	viewport->ssao_quality = camera_ssao_quality;
+	viewport->ssao_temporal = camera_ssao_temporal;
+	shared_ptr<World> world = cx->weak_world.lock();
+	Metrics* metrics = world ? &world->metrics : 0;
 
 	double rgb_depth_render = 0;
 	double rgb_oversample = 0;
@@ -52,42 +99,34 @@ void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, bool ren
 	QElapsedTimer timer;
 	timer.start();
 
-	viewport->paint(0, 0, 0, 0, 0, 0, this, 65535, VIEW_CAMERA_BIT, 0); // PAINT HERE
-	CHECK_GL_ERROR;
-	viewport->hud_update_start();
-	viewport->hud_print_score(score);
-	viewport->hud_update_finish();
-	CHECK_GL_ERROR;
+	if (render_rgb) {
+		MetricsTimer mt(metrics, METRIC_PAINT_RGB);
+		viewport->paint(0, 0, 0, 0, 0, 0, this, 65535, VIEW_CAMERA_BIT, 0); // PAINT HERE
+		CHECK_GL_ERROR;
+		viewport->hud_update_start();
+		viewport->hud_print_score(score);
+		viewport->hud_update_finish();
+		CHECK_GL_ERROR;
+	} else if (render_depth || (render_pointcloud && !render_labeling && !render_instances)) {
+		// depth sensor only: no color writes, no textures, no AO, no HUD
+		MetricsTimer mt(metrics, METRIC_PAINT_DEPTH);
+		viewport->paint(0, 0, 0, 0, 0, 0, this, 65535, VIEW_CAMERA_BIT|VIEW_DEPTH_ONLY, 0);
+		CHECK_GL_ERROR;
+	}
 
 	rgb_depth_render = timer.nsecsElapsed()/1000000.0;
 
 	// rgb
 	timer.start();
-	camera_rgb.resize(3*camera_res_w*camera_res_h);
-	uint8_t tmp[4*ow*oh]; // only 3*ow*oh required, but glReadPixels() somehow touches memory after this buffer, demonstrated on NVidia 375.20
-
-	glReadPixels(0, 0, ow, oh, GL_RGB, GL_UNSIGNED_BYTE, tmp);
-
-	if (RGB_OVERSAMPLING==0) {
-		for (int y=0; y<oh; ++y)
-			memcpy(&camera_rgb[y*3*ow], &tmp[(oh-1-y)*3*ow], 3*ow);
+	readback_tmp.resize(4*ow*oh); // only 3*ow*oh required, but glReadPixels() somehow touches memory after this buffer, demonstrated on NVidia 375.20
+	uint8_t* tmp = readback_tmp.data();
+	if (!render_rgb) {
+		camera_rgb.clear();
 	} else {
-		uint16_t acc[3*dw*dh];
-		memset(acc, 0, sizeof(uint16_t)*3*dw*dh);
-		int rs = 3*dw;
-		for (int oy=0; oy<oh; oy++) {
-			int dy = oy >> RGB_OVERSAMPLING;
-			uint8_t* src = &tmp[(oh-1-oy)*3*ow];
-			for (int ox=0; ox<ow; ox++) {
-				int dx = ox >> RGB_OVERSAMPLING;
-				acc[dy*rs + 3*dx + 0] += src[3*ox + 0];
-				acc[dy*rs + 3*dx + 1] += src[3*ox + 1];
-				acc[dy*rs + 3*dx + 2] += src[3*ox + 2];
-			}
-		}
-		uint8_t* dst = (uint8_t*) &camera_rgb[0];
-		for (int t=0; t<3*dw*dh; t++)
-			dst[t] = acc[t] >> (RGB_OVERSAMPLING+RGB_OVERSAMPLING);
+		camera_rgb.resize(3*dw*dh);
+		read_pixels(metrics, ow, oh, GL_RGB, GL_UNSIGNED_BYTE, tmp, 3*ow*oh);
+		MetricsTimer mt(metrics, METRIC_DOWNSAMPLE);
+		rgb_downsample(tmp, dw, dh, (uint8_t*) &camera_rgb[0], &readback_rgb_acc);
 	}
 	rgb_oversample = timer.nsecsElapsed()/1000000.0;
 
@@ -100,9 +139,11 @@ void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, bool ren
 		camera_aux_h = auxh;
 		camera_depth.resize(sizeof(float)*auxw*auxh);
 		camera_depth_mask.resize(auxw*auxh);
-		float ftmp[ow*oh];
+		readback_ftmp.resize(ow*oh);
+		float* ftmp = readback_ftmp.data();
 
-		glReadPixels(0, 0, ow, oh, GL_DEPTH_COMPONENT, GL_FLOAT, ftmp);
+		read_pixels(metrics, ow, oh, GL_DEPTH_COMPONENT, GL_FLOAT, ftmp, sizeof(float)*ow*oh);
+		MetricsTimer mt(metrics, METRIC_DOWNSAMPLE);
 
 		if (AUX_OVERSAMPLING==0) {
 			for (int y=0; y<oh; ++y) {
@@ -116,10 +157,10 @@ void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, bool ren
 				}
 			}
 		} else {
-			float acc[auxw*auxh];
-			float sqr[auxw*auxh];
-			memset(acc, 0, sizeof(float)*auxw*auxh);
-			memset(sqr, 0, sizeof(float)*auxw*auxh);
+			readback_acc.assign(auxw*auxh, 0.0f);
+			readback_sqr.assign(auxw*auxh, 0.0f);
+			float* acc = readback_acc.data();
+			float* sqr = readback_sqr.data();
 			int rs = auxw;
 			for (int oy=0; oy<oh; oy++) {
 				int dy = oy >> AUX_OVERSAMPLING;
@@ -151,18 +192,48 @@ void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, bool ren
 		dep_oversample = timer.nsecsElapsed()/1000000.0;
 	}
 
+	// instance ids, from different render (ids as color), before labeling so point cloud can take labels
+	camera_instances.clear();
+	if (render_instances) {
+		timer.start();
+		{
+			MetricsTimer mt(metrics, METRIC_PAINT_INSTANCES);
+			viewport->paint(0, 0, 0, 0, 0, 0, this, 65535, VIEW_INSTANCE_ID|VIEW_CAMERA_BIT, 0);
+		}
+		camera_aux_w = auxw;
+		camera_aux_h = auxh;
+		camera_instances.resize(sizeof(uint32_t)*auxw*auxh);
+		read_pixels(metrics, ow, oh, GL_RGB, GL_UNSIGNED_BYTE, tmp, 3*ow*oh);
+		MetricsTimer mt(metrics, METRIC_DOWNSAMPLE);
+		// ids can't be averaged, take center subpixel
+		const int block = 1 << AUX_OVERSAMPLING;
+		uint32_t* dst = (uint32_t*) &camera_instances[0];
+		for (int y=0; y<auxh; ++y) {
+			uint8_t* src = &tmp[((auxh-1-y)*block + block/2)*3*ow];
+			for (int x=0; x<auxw; ++x) {
+				uint8_t* p = &src[3*(x*block + block/2)];
+				dst[y*auxw + x] = (p[0] << 16) | (p[1] << 8) | p[2];
+			}
+		}
+		metatype_render += timer.nsecsElapsed()/1000000.0;
+	}
+
 	// dense object type presence, from different render (types as color)
 	if (render_labeling) {
 		timer.start();
 
-		viewport->paint(0, 0, 0, 0, 0, 0, this, 65535, VIEW_METACLASS|VIEW_CAMERA_BIT, 0); // PAINT HERE
+		{
+			MetricsTimer mt(metrics, METRIC_PAINT_LABELING);
+			viewport->paint(0, 0, 0, 0, 0, 0, this, 65535, VIEW_METACLASS|VIEW_CAMERA_BIT, 0); // PAINT HERE
+		}
 
 		camera_labeling.resize(auxw*auxh);
 		camera_labeling_mask.resize(auxw*auxh);
-		glReadPixels(0, 0, ow, oh, GL_RGB, GL_UNSIGNED_BYTE, tmp);
+		read_pixels(metrics, ow, oh, GL_RGB, GL_UNSIGNED_BYTE, tmp, 3*ow*oh);
 		metatype_render = timer.nsecsElapsed()/1000000.0;
 
 		timer.start();
+		MetricsTimer mt(metrics, METRIC_DOWNSAMPLE);
 		if (AUX_OVERSAMPLING==0) {
 			assert(auxw==ow && auxh==oh);
 			for (int y=0; y<oh; ++y) {
@@ -175,8 +246,8 @@ void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, bool ren
 				}
 			}
 		} else {
-			uint8_t bits_count[auxw*auxh*8];
-			memset(bits_count, 0, auxw*auxh*8);
+			readback_bits.assign(auxw*auxh*8, 0);
+			uint8_t* bits_count = readback_bits.data();
 			for (int oy=0; oy<oh; ++oy) {
 				int dy = oy >> AUX_OVERSAMPLING;
 				uint8_t* dst_count = &bits_count[dy*8*auxw];
@@ -217,13 +288,34 @@ void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, bool ren
 		metatype_oversample = timer.nsecsElapsed()/1000000.0;
 	}
 
+	// xyz from last pass depth, labels if last pass was labeling
+	camera_pointcloud.clear();
+#ifdef USE_SSAO
+	MetricsTimer mt_pointcloud(render_pointcloud ? metrics : 0, METRIC_PAINT_POINTCLOUD);
+	bool pointcloud_painted = render_pointcloud && viewport->pointcloud_paint(AUX_OVERSAMPLING, camera_pointcloud_world, render_labeling);
+	mt_pointcloud.stop();
+	if (pointcloud_painted) {
+		camera_aux_w = auxw;
+		camera_aux_h = auxh;
+		camera_pointcloud.resize(4*auxw*auxh*(camera_pointcloud_half ? 2 : 4));
+		read_pixels(metrics, auxw, auxh, GL_RGBA, camera_pointcloud_half ? GL_HALF_FLOAT : GL_FLOAT, &camera_pointcloud[0], camera_pointcloud.size()); // rows already top to bottom
+		CHECK_GL_ERROR;
+	}
+#endif
+	static bool pointcloud_warned = false; // once, not every frame
+	if (render_pointcloud && camera_pointcloud.empty() && !pointcloud_warned) {
+		fprintf(stderr, "camera '%s': point cloud needs built-in render with SSAO shaders\n", camera_name.c_str());
+		pointcloud_warned = true;
+	}
+	viewport->targets_release(); // all pixels read, next camera of that size can render into same set
+
 	bool balance_classes = true;
 	if (balance_classes && render_labeling) {
 		int count_floor = 0;
 		int count_walls = 0;
 		int count_items = 0;
 		uint8_t* msk1 = (uint8_t*) &camera_labeling_mask[0];
-		uint8_t* msk2 = (uint8_t*) &camera_depth_mask[0];
+		uint8_t* msk2 = render_depth ? (uint8_t*) &camera_depth_mask[0] : 0;
 		uint8_t* lab = (uint8_t*) &camera_labeling[0];
 		for (int t=0; t<auxw*auxh; t++) {
 			if (msk1[t]==0) continue;
@@ -239,7 +331,7 @@ void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, bool ren
 				if (!(lab[t] & (METACLASS_FLOOR|METACLASS_WALL))) continue;
 				if (rand() < threshold) continue;
 				msk1[t] = 0;
-				msk2[t] = 0;
+				if (msk2) msk2[t] = 0;
 			}
 		}
 	}
@@ -258,6 +350,120 @@ void Camera::camera_render(const shared_ptr<SimpleRender::Context>& cx, bool ren
 		);
 }
 
+void World::cameras_render_rgb(const std::vector<shared_ptr<Camera>>& cams, const std::vector<uint8_t*>& dst)
+{
+	TRACE_SPAN("cameras_render_rgb");
+	assert(cams.size()==dst.size());
+	cx->glcx->makeCurrent(cx->surf);
+	CHECK_GL_ERROR;
+
+	// Paint all first, readback goes into pixel buffers asynchronously, so GPU works on next
+	// camera while previous image is copied. Same camera requested twice is rendered once.
+	std::vector<shared_ptr<Camera>> unique;
+	for (const shared_ptr<Camera>& cam: cams)
+		if (std::find(unique.begin(), unique.end(), cam)==unique.end())
+			unique.push_back(cam);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (const shared_ptr<Camera>& cam: unique) {
+		int ow = cam->camera_res_w << RGB_OVERSAMPLING;
+		int oh = cam->camera_res_h << RGB_OVERSAMPLING;
+		if (!cam->viewport || cam->viewport->W!=ow || cam->viewport->H!=oh)
+			cam->viewport.reset(new SimpleRender::ContextViewport(cx, ow, oh, cam->camera_near, cam->camera_far, cam->camera_hfov));
+		cam->viewport->ssao_quality = cam->camera_ssao_quality;
+		cam->viewport->ssao_temporal = cam->camera_ssao_temporal;
+		MetricsTimer mt(&metrics, METRIC_PAINT_RGB);
+		cam->viewport->paint(0, 0, 0, 0, 0, 0, cam.get(), 65535, VIEW_CAMERA_BIT, 0);
+		cam->viewport->hud_update_start();
+		cam->viewport->hud_print_score(cam->score);
+		cam->viewport->hud_update_finish();
+		mt.stop();
+		size_t bytes = 3*ow*oh;
+		if (!cam->readback_pbo || cam->readback_pbo_bytes != bytes) {
+			cam->readback_pbo.reset(new Buffer);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, cam->readback_pbo->handle);
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, 0, GL_STREAM_READ);
+			cam->readback_pbo_bytes = bytes;
+		} else {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, cam->readback_pbo->handle);
+		}
+		glReadPixels(0, 0, ow, oh, GL_RGB, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		cam->viewport->targets_release(); // readback is queued before any later paint into same set
+		CHECK_GL_ERROR;
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	for (const shared_ptr<Camera>& cam: unique) {
+		int dw = cam->camera_res_w;
+		int dh = cam->camera_res_h;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, cam->readback_pbo->handle);
+		MetricsTimer mt(&metrics, METRIC_READBACK);
+		TraceSpan trace_map("glMapBufferRange");
+		const uint8_t* tmp = (const uint8_t*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, cam->readback_pbo_bytes, GL_MAP_READ_BIT);
+		trace_map.end();
+		mt.stop();
+		metrics.count(COUNTER_READBACK_BYTES, cam->readback_pbo_bytes);
+		if (!tmp) {
+			fprintf(stderr, "camera '%s': cannot map pixel buffer\n", cam->camera_name.c_str());
+			continue;
+		}
+		MetricsTimer mt_downsample(&metrics, METRIC_DOWNSAMPLE);
+		// downsample straight into first destination, others get a copy; camera_rgb is not touched
+		uint8_t* first = 0;
+		for (size_t c=0; c<cams.size(); c++) {
+			if (cams[c]!=cam || !dst[c]) continue;
+			if (!first) {
+				first = dst[c];
+				rgb_downsample(tmp, dw, dh, first, &cam->readback_rgb_acc);
+			} else {
+				memcpy(dst[c], first, 3*dw*dh);
+			}
+		}
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		cam->render_ts = -1; // scheduler has nothing cached for this camera now
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	CHECK_GL_ERROR;
+}
+
+bool Camera::camera_render_cached(World* world, uint32_t modalities)
+{
+	std::vector<btTransform> scene;
+	scene.reserve(world->drawlist.size() + 1);
+	shared_ptr<Thingy> attached = camera_attached_to.lock();
+	scene.push_back(attached ? attached->bullet_position : camera_pose);
+	for (const weak_ptr<Thingy>& w: world->drawlist) {
+		shared_ptr<Thingy> t = w.lock();
+		if (t) scene.push_back(t->bullet_position);
+	}
+
+	std::vector<float> params = {
+		float(camera_res_w), float(camera_res_h), float(camera_aux_w), float(camera_aux_h),
+		camera_hfov, camera_near, camera_far,
+		float(camera_ssao_quality), float(camera_ssao_temporal),
+		float(camera_pointcloud_world), float(camera_pointcloud_half) };
+
+	bool have_outputs =
+		render_ts >= 0 && world->ts >= render_ts && // ts goes back to 0 on clean_everything()
+		(render_had_modalities & modalities)==modalities &&
+		params==render_params;
+	bool interval_passed = camera_fps <= 0 || world->ts >= render_ts + 1.0/camera_fps - 1e-6;
+	bool moved = scene.size() != render_scene.size();
+	for (int i=0; i<(int)scene.size() && !moved; i++)
+		moved = !(scene[i]==render_scene[i]);
+
+	if (have_outputs && (!interval_passed || !moved)) {
+		render_hits++;
+		return true;
+	}
+	render_misses++;
+	render_ts = world->ts;
+	render_had_modalities = modalities;
+	render_scene.swap(scene);
+	render_params.swap(params);
+	return false;
+}
+
 
 void Viz::resizeGL(int w, int h)
 {
@@ -286,6 +492,8 @@ void Viz::_render_on_correctly_set_up_context()
 		caption.render(0x880000, win_w);
 	}
 	if (!render_viewport) return;
+	render_viewport->ssao_quality = ssao_quality;
+	render_viewport->ssao_temporal = ssao_temporal;
 
 	QElapsedTimer elapsed;
 	elapsed.start();
@@ -349,6 +557,31 @@ void Viz::paintGL()
 	_render_on_correctly_set_up_context();
 	CHECK_GL_ERROR;
 #endif
+	if (recorder) record_frame();
+}
+
+void Viz::record_start(const std::string& fn, float fps)
+{
+	qreal rat = devicePixelRatio();
+	recorder.reset(); // finishes previous file
+	recorder.reset(new VideoRecorder(fn, int(width()*rat+0.5), int(height()*rat+0.5), fps, true));
+}
+
+void Viz::record_frame()
+{
+	qreal rat = devicePixelRatio();
+	if (int(width()*rat+0.5)!=recorder->w || int(height()*rat+0.5)!=recorder->h) {
+		recorder->frames_dropped++; // window resized, y4m frame size is fixed
+		return;
+	}
+	uint8_t* dst = recorder->frame_acquire();
+	if (!dst) return;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, defaultFramebufferObject());
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, recorder->w, recorder->h, GL_RGB, GL_UNSIGNED_BYTE, dst);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	CHECK_GL_ERROR;
+	recorder->frame_commit();
 }
 
 Viz::~Viz()
@@ -489,7 +722,8 @@ void VizCamera::paintEvent(QPaintEvent* ev)
 	// rgb
 	QImage img_rgb(w, h, QImage::Format_RGB32);
 	img_rgb.fill(QColor(QRgb(0xFFFFFF)));
-	for (int y=0; y<h; y++) {
+	bool have_rgb = camera->camera_rgb.size()==size_t(3*w*h); // not rendered without CAMERA_RGB
+	for (int y=0; y<h && have_rgb; y++) {
 		uchar* u = img_rgb.scanLine(y);
 		uint8_t* src = (uint8_t*) &camera->camera_rgb[3*w*y];
 		for (int x=0; x<w; x++) {
@@ -67,20 +67,22 @@ public:
 	int ms_render_objectcount = 0;
 
 	uint32_t view_options = 0;
+	int  ssao_quality = Household::SSAO_FULL;
+	bool ssao_temporal = false;
 	float dup_opacity = 0.5;
 	int dup_transparent_mode = 0;
 
 	//shared_ptr<Household::Camera> camera;
 
 	std::vector<float> obs;
-	std::vector<float> obs_hist;
+	SimpleRender::HudHistory obs_hist;
 	std::vector<float> action;
-	std::vector<float> action_hist;
+	SimpleRender::HudHistory action_hist;
 	std::vector<float> reward;
-	std::vector<float> reward_hist;
+	SimpleRender::HudHistory reward_hist;
 	std::string score;
 	void history_advance(bool only_ensure_correct_sizes);
-	void drawhist(QPainter& p, const char* label, int bracketn, const QRect& r, const float* sensors_hist, const float* sensors);
+	void drawhist(QPainter& p, const char* label, int bracketn, const QRect& r, const SimpleRender::HudHistory& hist, const float* sensors);
 
 	int win_w, win_h;
 	bool resized = false;
@@ -95,6 +97,10 @@ public:
 
 	boost::weak_ptr<KeyCallback> key_callback;
 	void activate_key_callback(int event_type, int key, int modifiers);
+
+	shared_ptr<SimpleRender::VideoRecorder> recorder;
+	void record_start(const std::string& fn, float fps);
+	void record_frame();
 };
 
 class VizCamera: public QWidget {
@@ -2,7 +2,7 @@
 #include "render-glwidget.h"
 #include <QtOpenGL/QtOpenGL>
 
-static const int HIST = 150;
+static const int HIST = SimpleRender::HUD_HISTORY;
 
 void Viz::_paint_hud()
 {
@@ -26,6 +26,11 @@ void Viz::_paint_hud()
 
 	if ((~view_options & (VIEW_NO_HUD|VIEW_NO_CAPTIONS))==0) return;
 
+	history_advance(true);
+	obs_hist.upload();
+	action_hist.upload();
+	reward_hist.upload();
+
 	render_viewport->hud_update_start();
 
 	int top;
@@ -65,22 +70,20 @@ void Viz::_paint_hud()
 		}
 	}
 
-	history_advance(true);
-
 	int right = area.right() - HIST - MARGIN;
-	if (obs_hist.size() && (~view_options&VIEW_NO_HUD)) {
+	if (obs_hist.channels && (~view_options&VIEW_NO_HUD)) {
 		for (int c=0; c<(int)obs.size(); ++c) {
 			int x = right;
 			int y = top + 26*c;
 			QRect r(x, y, HIST, 20);
 			if ( (area & r) != r ) continue;
 			if ( r.bottom() > bottom ) continue;
-			drawhist(p, "obs", c, r, &obs_hist[0] + HIST*c, &obs[0] + c);
+			drawhist(p, "obs", c, r, obs_hist, &obs[0] + c);
 		}
 	}
 
 	int top_reward = bottom;
-	if (reward_hist.size() && (~view_options&VIEW_NO_HUD)) {
+	if (reward_hist.channels && (~view_options&VIEW_NO_HUD)) {
 		for (int c=0; c<(int)reward.size(); ++c) {
 			int x = MARGIN;
 			int y = bottom - 56.0*((int)reward.size()-1-c);
@@ -88,18 +91,18 @@ void Viz::_paint_hud()
 			if ( (area & r) != r ) continue;
 			top_reward = r.top();
 			if ( r.top() < top ) continue;
-			drawhist(p, "rew", c, r, &reward_hist[0] + HIST*c, &reward[0] + c);
+			drawhist(p, "rew", c, r, reward_hist, &reward[0] + c);
 		}
 	}
 
-	if (action_hist.size() && (~view_options&VIEW_NO_HUD)) {
+	if (action_hist.channels && (~view_options&VIEW_NO_HUD)) {
 		for (int c=0; c<(int)action.size(); ++c) {
 			int x = MARGIN;
 			int y = top + 26*c;
 			QRect r(x, y, HIST, 20);
 			if ( (area & r) != r ) continue;
 			if ( r.bottom() > top_reward ) continue;
-			drawhist(p, "act", c, r, &action_hist[0] + HIST*c, &action[0] + c);
+			drawhist(p, "act", c, r, action_hist, &action[0] + c);
 		}
 	}
 
@@ -110,29 +113,13 @@ void Viz::drawhist(
 	QPainter& p,
 	const char* label, int bracketn,
 	const QRect& r,
-	const float* sensors_hist,
+	const SimpleRender::HudHistory& hist,
 	const float* sensors)
 {
-	QColor bg = Qt::black;
-	bg.setAlpha(100);
+	render_viewport->hud_plot(r, hist, bracketn);
+
 	p.setCompositionMode(QPainter::CompositionMode_Source);
-	p.fillRect(r, bg);
-
-	int mid_y = r.center().y();
-	float half_height = r.height()*0.5f;
-	QImage& img = render_viewport->hud_image;
-
-	for (int h=0; h<HIST; h++) {
-		int x = r.left() + h;
-		float clamp = sensors_hist[h]*0.5;
-		if (clamp > 1.0f) clamp = 1.0f;
-		if (clamp < -1.0f) clamp = -1.0f;
-		int mag = int( 0.5 + mid_y - clamp*half_height );
-		for (int y=mid_y; y<mag; y++)
-			img.setPixel(x, y, 0xFFFF8080);
-		for (int y=mid_y; y>=mag; y--)
-			img.setPixel(x, y, 0xFF80FF80);
-	}
+	p.fillRect(r, Qt::transparent); // plot itself is on GPU, only label goes through hud_image
 
 	char buf[100];
 	snprintf(buf, sizeof(buf), "%s[%02i] = %+0.2f", label, bracketn, sensors[0]);
@@ -145,32 +132,15 @@ void Viz::drawhist(
 
 void Viz::history_advance(bool only_ensure_correct_sizes)
 {
-	int obs_hist_size = obs.size()*HIST;
-	if (obs_hist_size != (int)obs_hist.size())
-		obs_hist.assign(obs_hist_size, 0);
-	if (obs_hist_size > 0 && !only_ensure_correct_sizes) {
-		memmove(&obs_hist[0], &obs_hist[1], sizeof(obs_hist[0])*(obs_hist_size-1));
-		for (int c=0; c<(int)obs.size(); c++)
-			obs_hist[HIST*c+(HIST-1)] = obs[c];
-	}
-
-	int action_hist_size = action.size()*HIST;
-	if (action_hist_size != (int)action_hist.size())
-		action_hist.assign(action_hist_size, 0);
-	if (action_hist_size > 0 && !only_ensure_correct_sizes) {
-		memmove(&action_hist[0], &action_hist[1], sizeof(action_hist[0])*(action_hist_size-1));
-		for (int c=0; c<(int)action.size(); c++)
-			action_hist[HIST*c+(HIST-1)] = action[c];
-	}
-
-	int reward_hist_size = reward.size()*HIST;
-	if (reward_hist_size != (int)reward_hist.size())
-		reward_hist.assign(reward_hist_size, 0);
-	if (reward_hist_size > 0 && !only_ensure_correct_sizes) {
-		memmove(&reward_hist[0], &reward_hist[1], sizeof(reward_hist[0])*(reward_hist_size-1));
-		for (int c=0; c<(int)reward.size(); c++)
-			reward_hist[HIST*c+(HIST-1)] = reward[c];
+	if (only_ensure_correct_sizes) {
+		if (obs_hist.channels != (int)obs.size()) obs_hist.reset(obs.size());
+		if (action_hist.channels != (int)action.size()) action_hist.reset(action.size());
+		if (reward_hist.channels != (int)reward.size()) reward_hist.reset(reward.size());
+		return;
 	}
+	obs_hist.advance(obs);
+	action_hist.advance(action);
+	reward_hist.advance(reward);
 }
 
 void ConsoleMessage::render(uint32_t color, int width)
@@ -0,0 +1,123 @@
+#include "render-simple.h"
+#include <string.h>
+#include <errno.h>
+
+namespace SimpleRender {
+
+VideoRecorder::VideoRecorder(const std::string& fn_, int w_, int h_, float fps_, bool bottom_up_, int queue_len):
+	fn(fn_), w(w_), h(h_), fps(fps_), bottom_up(bottom_up_)
+{
+	f = fopen(fn.c_str(), "wb");
+	if (!f) throw std::runtime_error("cannot open '" + fn + "' with mode 'wb': " + strerror(errno) );
+	fprintf(f, "YUV4MPEG2 W%i H%i F%i:1000 Ip A1:1 C444\n", w, h, int(fps*1000 + 0.5));
+	ring.resize(queue_len);
+	for (std::vector<uint8_t>& frame: ring)
+		frame.resize(3*w*h); // all memory up front, nothing allocated while recording
+	encoder = std::thread(&VideoRecorder::encoder_loop, this);
+}
+
+VideoRecorder::~VideoRecorder()
+{
+	finish();
+}
+
+void VideoRecorder::finish()
+{
+	if (!f) return;
+	quit = true;
+	wake.notify_one();
+	encoder.join(); // encoder writes everything still in queue before exiting
+	fclose(f);
+	f = 0;
+}
+
+uint8_t* VideoRecorder::frame_acquire()
+{
+	uint32_t hd = head.load(std::memory_order_relaxed);
+	if (hd - tail.load(std::memory_order_acquire) >= ring.size()) {
+		frames_dropped++; // encoder can't keep up, better lose a frame than block the simulation
+		return 0;
+	}
+	return ring[hd % ring.size()].data();
+}
+
+void VideoRecorder::frame_commit()
+{
+	head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	wake.notify_one();
+}
+
+bool VideoRecorder::push_rgb(const uint8_t* rgb)
+{
+	uint8_t* dst = frame_acquire();
+	if (!dst) return false;
+	memcpy(dst, rgb, 3*w*h);
+	frame_commit();
+	return true;
+}
+
+void VideoRecorder::encoder_loop()
+{
+	std::vector<uint8_t> yuv(3*w*h);
+	while (1) {
+		uint32_t tl = tail.load(std::memory_order_relaxed);
+		if (tl == head.load(std::memory_order_acquire)) {
+			if (quit) break;
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			wake.wait_for(lock, std::chrono::milliseconds(10)); // no lock on producer side, so don't rely on notify alone
+			continue;
+		}
+		const uint8_t* rgb = ring[tl % ring.size()].data();
+		uint8_t* Y = &yuv[0];
+		uint8_t* U = &yuv[w*h];
+		uint8_t* V = &yuv[2*w*h];
+		for (int y=0; y<h; y++) {
+			const uint8_t* src = rgb + 3*w*(bottom_up ? h-1-y : y);
+			for (int x=0; x<w; x++) {
+				int r = src[3*x+0];
+				int g = src[3*x+1];
+				int b = src[3*x+2];
+				// BT.601, studio range
+				*Y++ = uint8_t( 16 + (( 66*r + 129*g +  25*b + 128) >> 8));
+				*U++ = uint8_t(128 + ((-38*r -  74*g + 112*b + 128) >> 8));
+				*V++ = uint8_t(128 + ((112*r -  94*g -  18*b + 128) >> 8));
+			}
+		}
+		tail.store(tl + 1, std::memory_order_release); // slot free, yuv is our own copy
+		fputs("FRAME\n", f);
+		if (fwrite(yuv.data(), 1, yuv.size(), f) != yuv.size()) {
+			fprintf(stderr, "cannot write '%s': %s, recording stopped\n", fn.c_str(), strerror(errno));
+			break;
+		}
+		frames_written++;
+	}
+}
+
+} // namespace
+
+namespace Household {
+
+void World::recording_tick()
+{
+	if (recording_cameras.empty() || !cx || !cx->glcx) return;
+	for (auto i=recording_cameras.begin(); i!=recording_cameras.end(); ) {
+		shared_ptr<Camera> cam = i->lock();
+		if (!cam || !cam->recorder) {
+			i = recording_cameras.erase(i);
+			continue;
+		}
+		++i;
+		if (cam->recorder_last_ts >= 0 && ts < cam->recorder_last_ts + 1.0/cam->camera_fps - 1e-6)
+			continue;
+		cam->recorder_last_ts = ts;
+		cam->camera_render(cx, CAMERA_RGB, false);
+		cam->render_ts = -1; // rgb only, scheduler cache is not consistent anymore
+		if (cam->camera_rgb.size() != size_t(3*cam->recorder->w*cam->recorder->h)) {
+			cam->recorder->frames_dropped++; // resolution changed while recording
+			continue;
+		}
+		cam->recorder->push_rgb((const uint8_t*) cam->camera_rgb.data());
+	}
+}
+
+}
@@ -0,0 +1,238 @@
+#define GL_GLEXT_PROTOTYPES
+#include "render-simple.h"
+#include <algorithm>
+
+namespace SimpleRender {
+
+using namespace Household;
+
+// Anything drawn within that many paints is kept, even over budget. Several viewports
+// (main window, robot cameras) paint in turn, each one advances frame_n.
+const uint64_t RESIDENCY_KEEP_FRAMES = 8;
+const uint64_t RESIDENCY_CHECK_EVERY = 30;
+const uint64_t RENDER_TARGETS_KEEP_FRAMES = 300;
+
+void Context::residency_sweep()
+{
+	for (auto i=allocated_vaos.begin(); i!=allocated_vaos.end(); ) {
+		if (i->unique()) {
+			i = allocated_vaos.erase(i);
+			continue;
+		}
+		++i;
+	}
+
+	for (auto i=allocated_buffers.begin(); i!=allocated_buffers.end(); ) {
+		if (i->unique()) {
+			i = allocated_buffers.erase(i);
+			continue;
+		}
+		++i;
+	}
+
+	//fprintf(stderr, "allocated_vaos %i\n", (int)allocated_vaos.size());
+	//fprintf(stderr, "allocated_buffers %i\n", (int)allocated_buffers.size());
+}
+
+void Context::render_targets_trim()
+{
+	for (auto i=render_targets_pool.begin(); i!=render_targets_pool.end(); ) {
+		std::vector<shared_ptr<RenderTargets>>& sets = i->second;
+		for (auto j=sets.begin(); j!=sets.end(); ) {
+			if ((*j).unique() && (*j)->last_used_frame + RENDER_TARGETS_KEEP_FRAMES < frame_n) {
+				render_targets_bytes -= (*j)->bytes;
+				j = sets.erase(j);
+				continue;
+			}
+			++j;
+		}
+		if (sets.empty()) {
+			i = render_targets_pool.erase(i);
+			continue;
+		}
+		++i;
+	}
+}
+
+void Context::residency_track(const shared_ptr<Shape>& shape)
+{
+	if (shape->gpu_residency_listed) return;
+	shape->gpu_residency_listed = true;
+	resident_shapes.push_back(shape);
+}
+
+struct ResidencyItem {
+	uint64_t last_used;
+	size_t bytes;
+	shared_ptr<Shape> shape;  // either shape, only owner of its VAO (copies draw it through gpu_source)
+	std::string texture_fn;   // or texture
+	bool operator<(const ResidencyItem& other) const  { return last_used < other.last_used; }
+};
+
+void Context::residency_enforce()
+{
+	if (!residency_dirty && frame_n < residency_checked_frame + RESIDENCY_CHECK_EVERY) return;
+	residency_dirty = false;
+	residency_checked_frame = frame_n;
+	render_targets_trim();
+
+	shared_ptr<World> world = weak_world.lock();
+	size_t budget_gpu = world ? world->residency_budget_gpu : 0;
+	size_t budget_cpu = world ? world->residency_budget_cpu : 0;
+
+	std::vector<ResidencyItem> items;
+	residency_gpu_bytes = 0;
+	residency_cpu_bytes = 0;
+	for (auto i=resident_shapes.begin(); i!=resident_shapes.end(); ) {
+		shared_ptr<Shape> s = i->lock();
+		if (!s || !s->vao) { // class gone, or evicted and not yet drawn again
+			if (s) s->gpu_residency_listed = false;
+			i = resident_shapes.erase(i);
+			continue;
+		}
+		residency_gpu_bytes += s->gpu_bytes;
+		residency_cpu_bytes += s->cpu_bytes();
+		items.push_back(ResidencyItem{ s->gpu_last_used_frame, s->gpu_bytes, s, std::string() });
+		++i;
+	}
+	for (auto i=bind_cache.begin(); i!=bind_cache.end(); ++i) {
+		if (!i->second) continue;
+		residency_gpu_bytes += i->second->bytes;
+		items.push_back(ResidencyItem{ i->second->last_used_frame, i->second->bytes, shared_ptr<Shape>(), i->first });
+	}
+	std::sort(items.begin(), items.end());
+
+	uint64_t keep_since = frame_n > RESIDENCY_KEEP_FRAMES ? frame_n - RESIDENCY_KEEP_FRAMES : 0;
+	bool evicted = false;
+
+	if (budget_cpu) {
+		for (const ResidencyItem& it: items) {
+			if (residency_cpu_bytes <= budget_cpu) break;
+			if (!it.shape || it.shape->cpu_released) continue;
+			size_t before = it.shape->cpu_bytes();
+			it.shape->cpu_release(); // it's on GPU, vertexes will be loaded again if evicted from there as well
+			if (!it.shape->cpu_released) continue;
+			residency_cpu_bytes -= before;
+			residency_released_cpu++;
+		}
+	}
+
+	if (budget_gpu) {
+		for (const ResidencyItem& it: items) {
+			if (residency_gpu_bytes <= budget_gpu) break;
+			if (it.last_used >= keep_since) break; // sorted, the rest is in use
+			if (it.shape) {
+				it.shape->vao.reset(); // nobody else holds it, GPU memory is freed in residency_sweep()
+				it.shape->buf_v.reset();
+				it.shape->buf_n.reset();
+				it.shape->buf_t.reset();
+				it.shape->gpu_bytes = 0;
+				residency_evicted_geometry++;
+			} else {
+				bind_cache.erase(it.texture_fn); // Material::texture_ref expires, material will request it again
+				residency_evicted_textures++;
+			}
+			residency_gpu_bytes -= it.bytes;
+			evicted = true;
+		}
+		if (residency_gpu_bytes > budget_gpu)
+			fprintf(stderr, "GPU residency budget %0.1fM exceeded by current frame: %0.1fM\n", budget_gpu/1048576.0, residency_gpu_bytes/1048576.0);
+	}
+
+	if (evicted)
+		residency_sweep();
+}
+
+}
+
+namespace Household {
+
+static size_t texture_bytes(const shared_ptr<SimpleRender::Texture>& t)  { return t ? t->bytes : 0; }
+static size_t buffer_bytes(const shared_ptr<SimpleRender::Buffer>& b)    { return b ? b->bytes : 0; }
+
+static void shapes_bytes(const shared_ptr<ShapeDetailLevels>& det, std::set<Shape*>& seen, size_t* cpu_bytes, size_t* cpu_released_bytes, int* shapes)
+{
+	if (!det) return;
+	for (int lev=0; lev<DETAIL_LEVELS; lev++)
+	for (const shared_ptr<Shape>& shape: det->detail_levels[lev]) {
+		if (!seen.insert(shape.get()).second) continue;
+		*cpu_bytes += shape->cpu_bytes();
+		if (cpu_released_bytes) *cpu_released_bytes += shape->cpu_released_bytes;
+		if (shapes) (*shapes)++;
+	}
+}
+
+void World::memory_report(MemoryReport* r)
+{
+	*r = MemoryReport();
+	const size_t MAP_NODE = 32; // tree node overhead, approximately
+
+	std::set<Shape*> seen;
+	for (auto i=klass_cache.begin(); i!=klass_cache.end(); ++i) {
+		r->cpu_lists += sizeof(*i) + MAP_NODE + i->first.capacity();
+		shared_ptr<ThingyClass> klass = i->second.lock();
+		if (!klass) continue;
+		r->klasses++;
+		shapes_bytes(klass->shapedet_visual, seen, &r->cpu_mesh, &r->cpu_mesh_released, &r->shapes);
+		shapes_bytes(klass->shapedet_collision, seen, &r->physics, 0, 0);
+	}
+
+	r->cpu_lists += drawlist.capacity()*sizeof(drawlist[0]);
+	r->cpu_lists += robotlist.capacity()*sizeof(robotlist[0]);
+	r->cpu_lists += bullet_handle_to_robot.size()*(sizeof(*bullet_handle_to_robot.begin()) + MAP_NODE);
+	for (const weak_ptr<Thingy>& w: drawlist) {
+		shared_ptr<Thingy> t = w.lock();
+		if (!t) continue;
+		r->thingies++;
+		r->physics += sizeof(Thingy) + t->name.capacity();
+	}
+	for (const weak_ptr<Robot>& w: robotlist) {
+		shared_ptr<Robot> robot = w.lock();
+		if (!robot) continue;
+		r->robots++;
+		r->physics += sizeof(Robot) + (robot->robot_parts.capacity() + robot->joints.capacity() + robot->cameras.capacity())*sizeof(shared_ptr<Thingy>);
+		for (const shared_ptr<Joint>& j: robot->joints) {
+			if (!j) continue; // fixed joint
+			r->joints++;
+			r->physics += sizeof(Joint) + j->joint_name.capacity();
+		}
+	}
+	r->bullet_bodies = b3GetNumBodies(client);
+
+	std::vector<shared_ptr<Camera>> all_cameras; // free floating and mounted on robots
+	for (const weak_ptr<Camera>& w: cameras) {
+		shared_ptr<Camera> cam = w.lock();
+		if (cam) all_cameras.push_back(cam);
+	}
+	for (const weak_ptr<Robot>& w: robotlist) {
+		shared_ptr<Robot> robot = w.lock();
+		if (!robot) continue;
+		for (const shared_ptr<Camera>& cam: robot->cameras)
+			if (cam) all_cameras.push_back(cam);
+	}
+	for (const shared_ptr<Camera>& cam: all_cameras) {
+		r->cameras++;
+		r->cpu_camera +=
+			cam->camera_rgb.capacity() + cam->camera_depth.capacity() + cam->camera_depth_mask.capacity() +
+			cam->camera_labeling.capacity() + cam->camera_labeling_mask.capacity() +
+			cam->camera_instances.capacity() + cam->camera_pointcloud.capacity() +
+			cam->readback_tmp.capacity() + cam->readback_bits.capacity() + sizeof(uint16_t)*cam->readback_rgb_acc.capacity() +
+			sizeof(float)*(cam->readback_ftmp.capacity() + cam->readback_acc.capacity() + cam->readback_sqr.capacity());
+		if (cam->readback_pbo) r->gpu_buffers += cam->readback_pbo_bytes;
+		SimpleRender::ContextViewport* v = cam->viewport.get();
+		if (!v) continue;
+		r->gpu_framebuffers += texture_bytes(v->tex_ao) + texture_bytes(v->tex_ao_depthlinear) + texture_bytes(v->tex_pointcloud) + texture_bytes(v->hud_texture);
+		r->gpu_buffers += buffer_bytes(v->hud_vertexbuf);
+	}
+
+	if (!cx) return; // nothing rendered yet
+	for (const shared_ptr<SimpleRender::Buffer>& b: cx->allocated_buffers)
+		r->gpu_buffers += b->bytes;
+	r->gpu_buffers += buffer_bytes(cx->draw_packets_ubo) + buffer_bytes(cx->ruler_vertexes);
+	for (auto i=cx->bind_cache.begin(); i!=cx->bind_cache.end(); ++i)
+		r->gpu_textures += texture_bytes(i->second);
+	r->gpu_textures += texture_bytes(cx->hbao_random);
+	r->gpu_framebuffers += cx->render_targets_bytes; // colors and depths of all viewports, shared by equal sizes
+}
+
+}
@@ -2,6 +2,7 @@
 #include "render-simple.h"
 #include <QtOpenGL/QtOpenGL>
 #include <QtOpenGL/QGLFramebufferObject>
+#include <algorithm>
 
 #ifdef __APPLE__
 #include <gl3.h>
@@ -128,19 +129,19 @@ Context::~Context()
 static void glMultMatrix(const float* m)  { glMultMatrixf(m); }  // this helps with btScalar
 static void glMultMatrix(const double* m) { glMultMatrixd(m); }
 
-int Context::cached_bind_texture(const std::string& image_fn)
+shared_ptr<Texture> Context::cached_bind_texture(const std::string& image_fn)
 {
 	auto f = bind_cache.find(image_fn);
 	if (f!=bind_cache.end())
 		return f->second;
-	int b = 0;
+	shared_ptr<Texture> t;
 	QImage img(QString::fromUtf8(image_fn.c_str()));
 	if (img.isNull()) {
 		fprintf(stderr, "cannot read image '%s'\n", image_fn.c_str());
 	} else {
 		//printf("image %ix%i <- %s\n", (int)img.width(), (int)img.height(), image_fn.c_str());
 		glActiveTexture(GL_TEXTURE0);
-		shared_ptr<Texture> t(new Texture());
+		t.reset(new Texture());
 		glBindTexture(GL_TEXTURE_2D, t->handle);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img.width(), img.height(), 0, GL_BGRA, GL_UNSIGNED_BYTE, img.scanLine(0));
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -149,13 +150,14 @@ int Context::cached_bind_texture(const std::string& image_fn)
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glGenerateMipmap(GL_TEXTURE_2D);
 		glBindTexture(GL_TEXTURE_2D, 0);
-		textures.push_back(t);
 		//assert(glGetError() == GL_NO_ERROR);
-		b = t->handle;
-		if (b==0) fprintf(stderr, "cannot bind texture '%s'\n", image_fn.c_str());
+		t->bytes = size_t(img.width())*img.height()*4*4/3; // with mipmaps
+		t->last_used_frame = frame_n;
+		residency_dirty = true;
+		if (t->handle==0) fprintf(stderr, "cannot bind texture '%s'\n", image_fn.c_str());
 	}
-	bind_cache[image_fn] = b; // we go on, even if texture isn't there -- better than crash
-	return b;
+	bind_cache[image_fn] = t; // we go on, even if texture isn't there -- better than crash
+	return t;
 }
 
 void Context::load_missing_textures()
@@ -191,29 +193,14 @@ void Context::load_missing_textures()
 			shared_ptr<Material> mat = pair.second;
 			if (mat->texture_loaded) continue;
 			if (mat->diffuse_texture_image_fn.empty()) continue;
-			mat->texture = cached_bind_texture(mat->diffuse_texture_image_fn);
+			shared_ptr<Texture> tex = cached_bind_texture(mat->diffuse_texture_image_fn);
+			mat->texture = tex ? tex->handle : 0;
+			mat->texture_ref = tex;
 			mat->texture_loaded = true;
 		}
 	}
 
-	for (auto i=allocated_vaos.begin(); i!=allocated_vaos.end(); ) {
-		if (i->unique()) {
-			i = allocated_vaos.erase(i);
-			continue;
-		}
-		++i;
-	}
-
-	for (auto i=allocated_buffers.begin(); i!=allocated_buffers.end(); ) {
-		if (i->unique()) {
-			i = allocated_buffers.erase(i);
-			continue;
-		}
-		++i;
-	}
-
-	//fprintf(stderr, "allocated_vaos %i\n", (int)allocated_vaos.size());
-	//fprintf(stderr, "allocated_buffers %i\n", (int)allocated_buffers.size());
+	residency_sweep();
 }
 
 static
@@ -254,6 +241,8 @@ void Context::initGL()
 	location_texture = program_tex->uniformLocation("texture_id");
 	location_uni_color = program_tex->uniformLocation("uni_color");
 	location_multiply_color = program_tex->uniformLocation("multiply_color");
+	location_draw_index = program_tex->uniformLocation("draw_index");
+	glUniformBlockBinding(program_tex->programId(), glGetUniformBlockIndex(program_tex->programId(), "DrawPackets"), DRAW_PACKETS_BINDING);
 	// can be -1 if uniform is actually unused in glsl code
 
 	program_displaytex = load_program("fullscreen_triangle.vert.glsl", "", "displaytex.frag.glsl");
@@ -266,6 +255,13 @@ void Context::initGL()
 	location_xywh = program_hud->uniformLocation("xywh");
 	location_zpos = program_hud->uniformLocation("zpos");
 
+	program_hud_plot = load_program("hud_plot.vert.glsl", "", "hud_plot.frag.glsl", "");
+	bool r3 = program_hud_plot->link();
+	assert(r3);
+	location_plot_xywh = program_hud_plot->uniformLocation("xywh");
+	location_plot_channel = program_hud_plot->uniformLocation("channel");
+	location_plot_head = program_hud_plot->uniformLocation("head");
+
 #ifdef USE_SSAO
 	if (ssao_enable)
 		ssao_enable = _hbao_init();
@@ -273,29 +269,87 @@ void Context::initGL()
 	assert(glGetError() == GL_NO_ERROR);
 }
 
-ContextViewport::ContextViewport(const shared_ptr<Context>& cx, int W, int H, double near, double far, double hfov):
-	cx(cx), W(W), H(H), near(near), far(far), hfov(hfov)
+shared_ptr<RenderTargets> Context::render_targets_borrow(int W, int H, uint32_t attachments)
+{
+	std::vector<shared_ptr<RenderTargets>>& sets = render_targets_pool[std::make_tuple(W, H, attachments)];
+	for (const shared_ptr<RenderTargets>& rt: sets) {
+		if (!rt.unique()) continue;
+		rt->last_used_frame = frame_n;
+		return rt;
+	}
+
+	shared_ptr<RenderTargets> rt(new RenderTargets);
+	rt->W = W;
+	rt->H = H;
+	rt->attachments = attachments;
+	rt->last_used_frame = frame_n;
+	rt->fbuf_scene.reset(new Framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, rt->fbuf_scene->handle);
+	if (attachments & RT_COLOR) {
+		rt->tex_color.reset(new Texture());
+		glBindTexture(GL_TEXTURE_2D, rt->tex_color->handle);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, W, H);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, rt->tex_color->handle, 0);
+		rt->bytes += 4*W*H;
+	}
+	if (attachments & RT_DEPTHSTENCIL) {
+		rt->tex_depthstencil.reset(new Texture());
+		glBindTexture(GL_TEXTURE_2D, rt->tex_depthstencil->handle);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, W, H);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, rt->tex_depthstencil->handle, 0);
+		rt->bytes += 4*W*H;
+	}
+	if (attachments & RT_DEPTHLINEAR) {
+		rt->tex_depthlinear.reset(new Texture());
+		glBindTexture(GL_TEXTURE_2D, rt->tex_depthlinear->handle);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, W, H);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		rt->fbuf_depthlinear.reset(new Framebuffer());
+		glBindFramebuffer(GL_FRAMEBUFFER, rt->fbuf_depthlinear->handle);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, rt->tex_depthlinear->handle, 0);
+		rt->bytes += 4*W*H;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	render_targets_bytes += rt->bytes;
+	sets.push_back(rt);
+	return rt;
+}
+
+void ContextViewport::targets_borrow()
 {
-	side = std::max(W, H);
 #ifdef USE_SSAO
-	_depthlinear_init();
+	targets = cx->render_targets_borrow(W, H, RT_COLOR|RT_DEPTHSTENCIL|RT_DEPTHLINEAR);
+#else
+	targets = cx->render_targets_borrow(W, H, RT_COLOR|RT_DEPTHSTENCIL);
 #endif
+	fbuf_scene = targets->fbuf_scene;
+	fbuf_depthlinear = targets->fbuf_depthlinear;
+	tex_color = targets->tex_color;
+	tex_depthstencil = targets->tex_depthstencil;
+	tex_depthlinear = targets->tex_depthlinear;
+}
 
-	fbuf_scene.reset(new Framebuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbuf_scene->handle);
-#ifndef USE_SSAO
-	tex_color.reset(new Texture());
-	glBindTexture(GL_TEXTURE_2D, tex_color->handle);
-	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, W, H);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	tex_depthstencil.reset(new Texture());
-	glBindTexture(GL_TEXTURE_2D, tex_depthstencil->handle);
-	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, W, H);
-	glBindTexture(GL_TEXTURE_2D, 0);
-#endif
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,        tex_color->handle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, tex_depthstencil->handle, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void ContextViewport::targets_release()
+{
+	fbuf_scene.reset();
+	fbuf_depthlinear.reset();
+	tex_color.reset();
+	tex_depthstencil.reset();
+	tex_depthlinear.reset();
+	targets.reset();
+}
+
+ContextViewport::ContextViewport(const shared_ptr<Context>& cx, int W, int H, double near, double far, double hfov):
+	cx(cx), W(W), H(H), near(near), far(far), hfov(hfov)
+{
+	side = std::max(W, H);
+	targets_borrow();
 
 	W16  = W;
 	W16 += 15;
@@ -305,12 +359,14 @@ ContextViewport::ContextViewport(const shared_ptr<Context>& cx, int W, int H, do
 	hud_texture.reset(new Texture());
 	glBindTexture(GL_TEXTURE_2D, hud_texture->handle);
 	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, W16, H);
+	hud_texture->bytes = 4*W16*H;
 
 	hud_vao.reset(new VAO);
 	glBindVertexArray(hud_vao->handle);
 	hud_vertexbuf.reset(new Buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, hud_vertexbuf->handle);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(hud_vertex), hud_vertex, GL_STATIC_DRAW);
+	hud_vertexbuf->bytes = sizeof(hud_vertex);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
 	glEnableVertexAttribArray(0);
 	glBindVertexArray(0);
@@ -325,70 +381,150 @@ Buffer::~Buffer()  { glDeleteBuffers(1, &handle); }
 VAO::VAO()  { glGenVertexArrays(1, &handle); }
 VAO::~VAO()  { glDeleteVertexArrays(1, &handle); }
 
-void ContextViewport::_render_single_object(const shared_ptr<Household::ShapeDetailLevels>& m, uint32_t options, int detail, const QMatrix4x4& at_pos)
+void ContextViewport::_collect_single_object(const shared_ptr<Household::ShapeDetailLevels>& m, uint32_t options, int detail, const btTransform& at_pos, uint8_t metaclass, uint32_t instance_id)
 {
 	const std::vector<shared_ptr<Shape>>& shapes = m->detail_levels[detail];
 
 	int cnt = shapes.size();
 	for (int c=0; c<cnt; c++) {
 		shared_ptr<Shape> t = shapes[c];
-		if (!t->vao) {
-			if (t->primitive_type!=Shape::MESH && t->primitive_type!=Shape::STATIC_MESH)
-				primitives_to_mesh(m, detail, c);
-			cx->_shape_to_vao(t);
+		if (!t->gpu_source && !t->vao && t->primitive_type!=Shape::MESH && t->primitive_type!=Shape::STATIC_MESH && !t->converted_to_mesh) {
+			primitives_to_mesh(m, detail, c); // can replace shapes[c] with a copy of best detail
+			t = shapes[c];
+		}
+		shared_ptr<Shape> g = t->gpu_source ? t->gpu_source : t; // geometry on GPU, copies draw their source
+		if (!g->vao) {
+			if (g->gpu_last_used_frame) cx->residency_reloaded_geometry++;
+			cx->_shape_to_vao(g);
 			//if (t->primitive_type==Shape::DEBUG_LINES) {
 			//if (options & VIEW_DEBUG_LINES)
 			//render_lines_overlay(t);
 		}
-
-		btScalar origin_trans_n_rotate[16];
-		t->origin.getOpenGLMatrix(origin_trans_n_rotate);
-		QMatrix4x4 shape_pos;
-		for (int i=0; i<16; i++) shape_pos.data()[i] = origin_trans_n_rotate[i];
-
-		QMatrix4x4 obj_modelview = modelview * at_pos * shape_pos;
-		cx->program_tex->setUniformValue(cx->location_input_matrix_modelview, obj_modelview);
-		cx->program_tex->setUniformValue(cx->location_input_matrix_modelview_inverse_transpose, obj_modelview.inverted().transposed());
+		g->gpu_last_used_frame = cx->frame_n;
+
+		// Object and shape transforms are rigid, inverse is cheap, no general 4x4 inversion here
+		btTransform obj = at_pos * t->origin;
+		btScalar obj_m[16];
+		btScalar obj_inv_m[16];
+		obj.getOpenGLMatrix(obj_m);
+		obj.inverse().getOpenGLMatrix(obj_inv_m);
+		QMatrix4x4 obj_pos;
+		QMatrix4x4 obj_inv;
+		for (int i=0; i<16; i++) obj_pos.data()[i] = obj_m[i];
+		for (int i=0; i<16; i++) obj_inv.data()[i] = obj_inv_m[i];
+
+		cx->draw_packets.push_back(DrawPacket());
+		DrawPacket& packet = cx->draw_packets.back();
+		QMatrix4x4 obj_modelview = modelview * obj_pos;
+		QMatrix4x4 obj_modelview_inverse_transpose = modelview_inverse_transpose * obj_inv.transposed();
+		memcpy(packet.data.modelview, obj_modelview.constData(), sizeof(packet.data.modelview));
+		memcpy(packet.data.modelview_inverse_transpose, obj_modelview_inverse_transpose.constData(), sizeof(packet.data.modelview_inverse_transpose));
 
 		uint32_t color = 0;
-		uint32_t multiply_color = 0xFFFFFF;
 		bool use_texture = false;
 		bool meta = options & VIEW_METACLASS;
-		if (!meta && t->material) {
+		bool instance = options & VIEW_INSTANCE_ID;
+		bool depth_only = options & VIEW_DEPTH_ONLY;
+		if (!meta && !instance && !depth_only && t->material) {
 			color = t->material->diffuse_color;
-			multiply_color = t->material->multiply_color;
-			use_texture = !t->t.empty() && t->material->texture;
+			use_texture = g->gpu_has_texcoords && t->material->texture;
+			if (use_texture) {
+				shared_ptr<Texture> tex = t->material->texture_ref.lock();
+				if (tex) {
+					tex->last_used_frame = cx->frame_n;
+				} else {
+					// evicted, load again on next frame
+					t->material->texture = 0;
+					t->material->texture_loaded = false;
+					cx->need_load_missing_textures = true;
+					cx->residency_reloaded_textures++;
+					use_texture = false;
+				}
+			}
 		}
 		if (options & VIEW_COLLISION_SHAPE) color ^= (0xFFFFFF & (uint32_t) (uintptr_t) t.get());
-		int triangles = t->v.size();
 
-		{
-			float r = float(1/256.0) * ((multiply_color >> 16) & 255);
-			float g = float(1/256.0) * ((multiply_color >>  8) & 255);
-			float b = float(1/256.0) * ((multiply_color >>  0) & 255);
-			cx->program_tex->setUniformValue(cx->location_multiply_color, r, g, b, 1);
-		}
 		{
 			float a = float(1/256.0) * ((color >> 24) & 255);
 			if (a==0) a = 1; // allow to specify colors in simple form 0xAABBCC
-			float r = float(1/256.0) * ((color >> 16) & 255);
-			float g = float(1/256.0) * ((color >>  8) & 255);
-			float b = float(1/256.0) * ((color >>  0) & 255);
-			cx->program_tex->setUniformValue(cx->location_uni_color, r, g, b, cx->pure_color_opacity*a);
+			packet.data.color[0] = float(1/256.0) * ((color >> 16) & 255);
+			packet.data.color[1] = float(1/256.0) * ((color >>  8) & 255);
+			packet.data.color[2] = float(1/256.0) * ((color >>  0) & 255);
+			packet.data.color[3] = cx->pure_color_opacity*a;
 		}
-
-		glBindVertexArray(t->vao->handle);
-		if (use_texture) {
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, t->material->texture);
-		} else {
+		if (meta) {
+			// labels in blue channel, camera reads them back bitwise
+			packet.data.color[0] = 0;
+			packet.data.color[1] = 0;
+			packet.data.color[2] = metaclass / 255.0f;
+			packet.data.color[3] = 1;
+		}
+		if (instance) {
+			// 24 bit Thingy::instance_id in rgb, 0 is background
+			packet.data.color[0] = ((instance_id >> 16) & 255) / 255.0f;
+			packet.data.color[1] = ((instance_id >>  8) & 255) / 255.0f;
+			packet.data.color[2] = ((instance_id >>  0) & 255) / 255.0f;
+			packet.data.color[3] = 1;
 		}
-		cx->program_tex->setUniformValue(cx->location_enable_texture, use_texture);
-		cx->program_tex->setUniformValue(cx->location_texture, 0);
+		packet.data.flags[0] = use_texture;
+		packet.data.flags[1] = meta || instance;
+		packet.data.flags[2] = packet.data.flags[3] = 0;
+		packet.texture = use_texture ? t->material->texture : 0;
+		packet.vao = g->vao->handle;
+		packet.vertexes = g->gpu_vertex_count;
+	}
+}
 
-		glDrawArrays(GL_TRIANGLES, 0, triangles/3);
-		glBindVertexArray(0);
+void ContextViewport::_draw_packets()
+{
+	std::vector<DrawPacket>& packets = cx->draw_packets;
+	if (packets.empty()) return;
+	std::stable_sort(packets.begin(), packets.end());
+
+	int stride = cx->draw_packets_block_stride;
+	if (!stride) {
+		GLint align = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+		int block = sizeof(DrawData)*DRAW_PACKETS_PER_BLOCK;
+		stride = (block + align - 1) / align * align;
+		cx->draw_packets_block_stride = stride;
+	}
+	int cnt = packets.size();
+	int blocks = (cnt + DRAW_PACKETS_PER_BLOCK - 1) / DRAW_PACKETS_PER_BLOCK;
+	std::vector<uint8_t>& data = cx->draw_packets_data;
+	data.resize(blocks*stride);
+	for (int i=0; i<cnt; i++)
+		memcpy(&data[(i/DRAW_PACKETS_PER_BLOCK)*stride + (i%DRAW_PACKETS_PER_BLOCK)*sizeof(DrawData)], &packets[i].data, sizeof(DrawData));
+
+	if (!cx->draw_packets_ubo) cx->draw_packets_ubo.reset(new Buffer);
+	GLuint ubo = cx->draw_packets_ubo->handle;
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STREAM_DRAW);
+	cx->draw_packets_ubo->bytes = data.size();
+
+	GLuint bound_texture = 0;
+	GLuint bound_vao = 0;
+	glActiveTexture(GL_TEXTURE0);
+	for (int i=0; i<cnt; i++) {
+		const DrawPacket& packet = packets[i];
+		if (i % DRAW_PACKETS_PER_BLOCK == 0)
+			glBindBufferRange(GL_UNIFORM_BUFFER, DRAW_PACKETS_BINDING, ubo, (i/DRAW_PACKETS_PER_BLOCK)*stride, sizeof(DrawData)*DRAW_PACKETS_PER_BLOCK);
+		if (packet.texture && packet.texture != bound_texture) {
+			glBindTexture(GL_TEXTURE_2D, packet.texture);
+			bound_texture = packet.texture;
+		}
+		if (packet.vao != bound_vao) {
+			glBindVertexArray(packet.vao);
+			bound_vao = packet.vao;
+		}
+		glUniform1i(cx->location_draw_index, i % DRAW_PACKETS_PER_BLOCK);
+		glDrawArrays(GL_TRIANGLES, 0, packet.vertexes);
 	}
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glUniform1i(cx->location_draw_index, -1);
+	packets.clear();
 }
 
 int ContextViewport::_objects_loop(int floor_visible, uint32_t view_options)
@@ -410,19 +546,12 @@ int ContextViewport::_objects_loop(int floor_visible, uint32_t view_options)
 
 		ms_render_objectcount++;
 
-		btScalar m[16];
-		t->bullet_position.getOpenGLMatrix(m);
-		QMatrix4x4 pos;
-		for (int i=0; i<16; i++) pos.data()[i] = m[i];
-		t->bullet_local_inertial_frame.inverse().getOpenGLMatrix(m);
-		QMatrix4x4 loc;
-		for (int i=0; i<16; i++) loc.data()[i] = m[i];
-
-		_render_single_object(t->klass->shapedet_visual, view_options, DETAIL_BEST, pos*loc);
+		_collect_single_object(t->klass->shapedet_visual, view_options, DETAIL_BEST, t->bullet_position * t->bullet_local_inertial_frame.inverse(), t->klass->metaclass, t->instance_id);
 
 		++i;
 	}
 
+	_draw_packets();
 	return ms_render_objectcount;
 }
 
@@ -433,6 +562,7 @@ void Context::_generate_ruler_vao()
 	ruler_vertexes.reset(new Buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, ruler_vertexes->handle);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(line_vertex), line_vertex, GL_STATIC_DRAW);
+	ruler_vertexes->bytes = sizeof(line_vertex);
 	glVertexAttribPointer(ATTR_N_VERTEX, 3, GL_FLOAT, GL_FALSE, 0, NULL);
 	glEnableVertexAttribArray(ATTR_N_VERTEX);
 	glBindVertexArray(0);
@@ -440,6 +570,8 @@ void Context::_generate_ruler_vao()
 
 void Context::_shape_to_vao(const boost::shared_ptr<Household::Shape>& shape)
 {
+	if (shape->cpu_released)
+		shape->cpu_restore(); // context lost or geometry evicted, need vertexes again
 	shape->vao.reset(new VAO);
 	allocated_vaos.push_back(shape->vao);
 	glBindVertexArray(shape->vao->handle);
@@ -449,6 +581,7 @@ void Context::_shape_to_vao(const boost::shared_ptr<Household::Shape>& shape)
 	allocated_buffers.push_back(shape->buf_v);
 	glBindBuffer(GL_ARRAY_BUFFER, shape->buf_v->handle);
 	glBufferData(GL_ARRAY_BUFFER, shape->v.size()*sizeof(shape->v[0]), shape->v.data(), GL_STATIC_DRAW);
+	shape->buf_v->bytes = shape->v.size()*sizeof(shape->v[0]);
 	glVertexAttribPointer(ATTR_N_VERTEX, 3, GL_FLOAT, GL_FALSE, 0, NULL);
 
 	assert(shape->norm.size() > 0);
@@ -456,6 +589,7 @@ void Context::_shape_to_vao(const boost::shared_ptr<Household::Shape>& shape)
 	allocated_buffers.push_back(shape->buf_n);
 	glBindBuffer(GL_ARRAY_BUFFER, shape->buf_n->handle);
 	glBufferData(GL_ARRAY_BUFFER, shape->norm.size()*sizeof(shape->norm[0]), shape->norm.data(), GL_STATIC_DRAW);
+	shape->buf_n->bytes = shape->norm.size()*sizeof(shape->norm[0]);
 	glVertexAttribPointer(ATTR_N_NORMAL, 3, GL_FLOAT, GL_FALSE, 0, NULL);
 
 	if (shape->t.size()) {
@@ -463,6 +597,7 @@ void Context::_shape_to_vao(const boost::shared_ptr<Household::Shape>& shape)
 		allocated_buffers.push_back(shape->buf_t);
 		glBindBuffer(GL_ARRAY_BUFFER, shape->buf_t->handle);
 		glBufferData(GL_ARRAY_BUFFER, shape->t.size()*sizeof(shape->t[0]), shape->t.data(), GL_STATIC_DRAW);
+		shape->buf_t->bytes = shape->t.size()*sizeof(shape->t[0]);
 		glVertexAttribPointer(ATTR_N_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 0, NULL);
 		glEnableVertexAttribArray(ATTR_N_TEXCOORD);
 	}
@@ -470,16 +605,28 @@ void Context::_shape_to_vao(const boost::shared_ptr<Household::Shape>& shape)
 	glEnableVertexAttribArray(ATTR_N_VERTEX);
 	glEnableVertexAttribArray(ATTR_N_NORMAL);
 	glBindVertexArray(0);
+
+	shape->gpu_vertex_count = shape->v.size()/3;
+	shape->gpu_has_texcoords = !shape->t.empty();
+	shape->gpu_bytes = (shape->v.size() + shape->norm.size() + shape->t.size())*sizeof(float);
+	residency_track(shape);
+	residency_dirty = true;
+
+	shared_ptr<Household::World> world = weak_world.lock();
+	if (world && world->gpu_resident_meshes)
+		shape->cpu_release();
 }
 
 void ContextViewport::paint(float user_x, float user_y, float user_z, float wheel, float zrot, float xrot, Household::Camera* camera, int floor_visible, uint32_t view_options, float ruler_size)
 {
+	TRACE_SPAN("paint");
 	if (!cx->program_tex) {
 		cx->initGL();
 		cx->_generate_ruler_vao();
 	}
 
 	if (camera) floor_visible = 65535; // disable visibility_123 for robot cameras
+	if (!targets) targets_borrow();
 	//fprintf(stderr, "0x%p render %ix%i\n", this, W, H);
 #ifdef USE_SSAO
 	glBindFramebuffer(GL_FRAMEBUFFER, fbuf_scene->handle);
@@ -490,12 +637,23 @@ void ContextViewport::paint(float user_x, float user_y, float user_z, float whee
 #endif
 	glViewport(0,0,W,H);
 
+#ifdef USE_SSAO
+	_timer_collect();
+	bool query_issued = timer_query_tier < 0; // previous result collected, query object free
+	if (query_issued) {
+		if (!timer_query) glGenQueries(1, &timer_query);
+		glBeginQuery(GL_TIME_ELAPSED, timer_query);
+	}
+#endif
+
 	float clear_color[4] = { 0.8, 0.8, 0.9, 1.0 };
+	float clear_labels[4] = { 0, 0, 0, 1 };
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glClearBufferfv(GL_COLOR, 0, clear_color);
+	if (~view_options & VIEW_DEPTH_ONLY)
+		glClearBufferfv(GL_COLOR, 0, (view_options & (VIEW_METACLASS|VIEW_INSTANCE_ID)) ? clear_labels : clear_color);
 	glClearDepth(1.0);
 	glClear(GL_DEPTH_BUFFER_BIT|GL_STENCIL_BUFFER_BIT);
 
@@ -521,8 +679,12 @@ void ContextViewport::paint(float user_x, float user_y, float user_z, float whee
 	}
 
 	modelview = projection * matrix_view;
+	last_projection = projection;
+	last_view = matrix_view;
 	modelview_inverse_transpose = modelview.inverted().transposed();
 
+	cx->frame_n++;
+	cx->residency_enforce();
 	if (cx->need_load_missing_textures) {
 		cx->need_load_missing_textures = false;
 		cx->load_missing_textures();
@@ -530,6 +692,7 @@ void ContextViewport::paint(float user_x, float user_y, float user_z, float whee
 
 	cx->program_tex->bind();
 	glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+	cx->program_tex->setUniformValue(cx->location_draw_index, -1);
 	cx->program_tex->setUniformValue(cx->location_enable_texture, false);
 	cx->program_tex->setUniformValue(cx->location_uni_color, 0,0,0,0.8);
 	cx->program_tex->setUniformValue(cx->location_texture, 0);
@@ -541,14 +704,19 @@ void ContextViewport::paint(float user_x, float user_y, float user_z, float whee
 		glDrawArrays(GL_LINES, 0, sizeof(line_vertex)/sizeof(float)/3);
 		glBindVertexArray(0);
 	}
+	if (view_options & VIEW_DEPTH_ONLY)
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 	visible_object_count = _objects_loop(floor_visible, view_options);
+	if (view_options & VIEW_DEPTH_ONLY)
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 	cx->program_tex->release();
 
 #ifdef USE_SSAO
-	if (cx->ssao_enable) {
-		_hbao_prepare(projection.data());
-		_depthlinear_paint(0);
-		_ssao_run(0);
+	// AO would spoil labels and instance ids, and there's no color at all in depth only pass
+	int tier = (view_options & (VIEW_METACLASS|VIEW_INSTANCE_ID|VIEW_DEPTH_ONLY)) ? SSAO_OFF : _ssao_paint(projection);
+	if (query_issued) {
+		glEndQuery(GL_TIME_ELAPSED);
+		timer_query_tier = tier;
 	}
 
 	if (camera) {
@@ -580,6 +748,11 @@ void ContextViewport::_texture_paint(GLuint h)
 	glDrawArrays(GL_TRIANGLES, 0, 3);
 }
 
+ContextViewport::~ContextViewport()
+{
+	if (timer_query) glDeleteQueries(1, &timer_query);
+}
+
 int ContextViewport::hud_print_score(const std::string& score)
 {
 	const int SCORE_HEIGHT = 50;
@@ -628,6 +801,66 @@ void ContextViewport::hud_update_finish()
 	cx->program_hud->release();
 }
 
+void ContextViewport::hud_plot(const QRect& r, const HudHistory& hist, int channel)
+{
+	// called between hud_update_start() and hud_update_finish(), goes under text hud_update() draws in the same rect
+	if (!hist.tex || channel >= hist.tex_channels) return;
+	cx->program_hud_plot->bind();
+	cx->program_hud_plot->setUniformValue(cx->location_plot_xywh, -1+2*float(r.left())/W, -1+2*float(r.top())/H, 2*float(r.width())/W, 2*float(r.height())/H);
+	cx->program_hud_plot->setUniformValue(cx->location_plot_channel, channel);
+	cx->program_hud_plot->setUniformValue(cx->location_plot_head, hist.head);
+	glBindTexture(GL_TEXTURE_2D, hist.tex->handle);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	glBindTexture(GL_TEXTURE_2D, hud_texture->handle);
+	cx->program_hud->bind();
+}
+
+void HudHistory::reset(int channels_)
+{
+	channels = channels_;
+	head = 0;
+	ring.assign(channels*HUD_HISTORY, 0);
+	not_uploaded = HUD_HISTORY;
+}
+
+void HudHistory::advance(const std::vector<float>& sample)
+{
+	if ((int)sample.size() != channels) reset(sample.size());
+	for (int c=0; c<channels; c++)
+		ring[c*HUD_HISTORY + head] = sample[c];
+	head = (head+1) % HUD_HISTORY;
+	not_uploaded++;
+}
+
+void HudHistory::upload()
+{
+	if (channels==0) return;
+	if (!tex || tex_channels != channels) {
+		tex.reset(new Texture());
+		glBindTexture(GL_TEXTURE_2D, tex->handle);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, HUD_HISTORY, channels);
+		tex->bytes = 4*HUD_HISTORY*channels;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		tex_channels = channels;
+		not_uploaded = HUD_HISTORY;
+	} else {
+		if (not_uploaded==0) return;
+		glBindTexture(GL_TEXTURE_2D, tex->handle);
+	}
+	if (not_uploaded > HUD_HISTORY) not_uploaded = HUD_HISTORY;
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, HUD_HISTORY);
+	int x = (head - not_uploaded + HUD_HISTORY) % HUD_HISTORY;
+	while (not_uploaded > 0) { // only new columns, in at most two pieces because of wraparound
+		int n = std::min(not_uploaded, HUD_HISTORY - x);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, 0, n, channels, GL_RED, GL_FLOAT, &ring[x]);
+		not_uploaded -= n;
+		x = 0;
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 void ContextViewport::hud_print(const QRect& r, const QString& msg_text, uint32_t bg, uint32_t fg, Qt::Alignment a, bool big_font)
 {
 	const int MARGIN = 10;
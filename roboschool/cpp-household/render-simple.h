@@ -3,6 +3,11 @@
 #include "household.h"
 
 #include <boost/shared_ptr.hpp>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <tuple>
 #include <QtWidgets/QOpenGLWidget>
 #include <QtGui/QSurface>
 #include <QtGui/QOffscreenSurface>
@@ -26,6 +31,7 @@ using boost::shared_ptr;
 using boost::weak_ptr;
 
 extern void primitives_to_mesh(const shared_ptr<Household::ShapeDetailLevels>& m, int want_detail, int shape_n);
+extern void primitive_to_mesh(Household::Shape* shape, int want_detail);
 extern shared_ptr<QGLShaderProgram> load_program(const std::string& vert_fn, const std::string& geom_fn, const std::string& frag_fn, const char* vert_defines=0, const char* geom_defines=0, const char* frag_defines=0);
 
 enum {
@@ -34,6 +40,8 @@ enum {
 	VIEW_DEBUG_LINES     = 0x0002,
 	VIEW_COLLISION_SHAPE = 0x0004,
 	VIEW_METACLASS       = 0x0010,
+	VIEW_DEPTH_ONLY      = 0x0020,
+	VIEW_INSTANCE_ID     = 0x0040,
 	VIEW_NO_HUD          = 0x1000,
 	VIEW_NO_CAPTIONS     = 0x2000,
 };
@@ -42,6 +50,8 @@ enum {
 
 struct Texture {
 	GLuint handle;
+	size_t bytes = 0; // for World::memory_report(), residency only evicts textures loaded from files
+	uint64_t last_used_frame = 0;
 	Texture();
 	~Texture();
 };
@@ -54,6 +64,7 @@ struct Framebuffer {
 
 struct Buffer {
 	GLuint handle;
+	size_t bytes = 0; // for World::memory_report()
 	Buffer();
 	~Buffer();
 };
@@ -64,6 +75,87 @@ struct VAO {
 	~VAO();
 };
 
+// Scene framebuffer with its textures. ContextViewport borrows a set from Context::render_targets_borrow()
+// while it paints, robot cameras give it back after reading pixels, so cameras of equal size share one set.
+enum {
+	RT_COLOR        = 0x01,
+	RT_DEPTHSTENCIL = 0x02,
+	RT_DEPTHLINEAR  = 0x04,
+};
+struct RenderTargets {
+	int W, H;
+	uint32_t attachments;
+	size_t bytes = 0;
+	uint64_t last_used_frame = 0;
+	shared_ptr<Framebuffer> fbuf_scene;
+	shared_ptr<Framebuffer> fbuf_depthlinear;
+	shared_ptr<Texture> tex_color;
+	shared_ptr<Texture> tex_depthstencil;
+	shared_ptr<Texture> tex_depthlinear;
+};
+
+// Last HUD_HISTORY samples of several channels (observations, actions, rewards). Samples go into
+// a ring, only new columns are uploaded to texture, plots are drawn from it by hud_plot shader.
+const int HUD_HISTORY = 150;
+struct HudHistory {
+	int channels = 0;
+	int head = 0;         // column of oldest sample, next one to overwrite
+	int not_uploaded = 0;
+	std::vector<float> ring; // channels rows of HUD_HISTORY samples
+	shared_ptr<Texture> tex;
+	int tex_channels = 0;
+	void reset(int channels);
+	void advance(const std::vector<float>& sample);
+	void upload(); // needs GL context
+};
+
+// Objects are drawn in two steps: collect draw packets, then sort them to change textures and VAOs
+// less often, upload per draw data into uniform buffer at once, one integer uniform per draw.
+const int DRAW_PACKETS_PER_BLOCK = 64;  // keep in sync with simple_texturing.vert.glsl
+const int DRAW_PACKETS_BINDING = 0;
+struct DrawData {                      // std140 layout of DrawData in simple_texturing.vert.glsl
+	float modelview[16];
+	float modelview_inverse_transpose[16];
+	float color[4];
+	int32_t flags[4];                  // [0] enable texture, [1] flat color
+};
+struct DrawPacket {
+	GLuint texture;                    // 0 if not textured
+	GLuint vao;
+	int vertexes;
+	DrawData data;
+	bool operator<(const DrawPacket& other) const  { return texture < other.texture || (texture==other.texture && vao < other.vao); }
+};
+
+// Writes RGB frames into .y4m file on a background thread. Render code fills preallocated
+// frames of a single producer single consumer ring, frames are dropped if ring is full.
+struct VideoRecorder {
+	std::string fn;
+	int w, h;
+	float fps;
+	bool bottom_up; // rows as glReadPixels() returns them
+	FILE* f;
+
+	VideoRecorder(const std::string& fn, int w, int h, float fps, bool bottom_up, int queue_len=32);
+	~VideoRecorder();
+	uint8_t* frame_acquire(); // 3*w*h bytes to fill, or 0 if frame dropped
+	void frame_commit();
+	bool push_rgb(const uint8_t* rgb);
+	void finish(); // blocks until queue is written, frames_written is final after that
+
+	std::atomic<int> frames_written{0};
+	std::atomic<int> frames_dropped{0};
+
+	std::vector<std::vector<uint8_t>> ring;
+	std::atomic<uint32_t> head{0}; // frames committed, only producer writes it
+	std::atomic<uint32_t> tail{0}; // frames encoded, only encoder writes it
+	std::atomic<bool> quit{false};
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	std::thread encoder;
+	void encoder_loop();
+};
+
 const int AO_RANDOMTEX_SIZE = 4;
 const int MAX_SAMPLES = 8;
 const int NUM_MRT = 8;
@@ -85,7 +177,6 @@ struct Context {
 	QOffscreenSurface* surf = 0;
 	QOpenGLContext* glcx = 0;
 	QOpenGLWidget* dummy_openglwidget = 0;
-	std::vector<shared_ptr<Texture>> textures;
 
 	int location_input_matrix_modelview_inverse_transpose;
 	int location_input_matrix_modelview;
@@ -93,10 +184,29 @@ struct Context {
 	int location_texture;
 	int location_uni_color;
 	int location_multiply_color;
+	int location_draw_index;
 	shared_ptr<QGLShaderProgram> program_tex;
+	std::vector<DrawPacket> draw_packets;
+	std::vector<uint8_t> draw_packets_data;
+	shared_ptr<Buffer> draw_packets_ubo;
+	int draw_packets_block_stride = 0;
 
 	int location_clipInfo;
+	int location_downsample;
 	shared_ptr<QGLShaderProgram> program_depth_linearize;
+	int location_upsample_texAO;
+	int location_upsample_texLowDepth;
+	int location_upsample_texFullDepth;
+	int location_upsample_downsample;
+	shared_ptr<QGLShaderProgram> program_ssao_upsample;
+	int location_pointcloud_texLinearDepth;
+	int location_pointcloud_texDepth;
+	int location_pointcloud_texLabels;
+	int location_pointcloud_projInfo;
+	int location_pointcloud_to_output;
+	int location_pointcloud_shift;
+	int location_pointcloud_have_labels;
+	shared_ptr<QGLShaderProgram> program_pointcloud;
 	//shared_ptr<QGLShaderProgram> program_depth_linearize_msaa;
 
 	shared_ptr<QGLShaderProgram> program_displaytex;
@@ -118,6 +228,8 @@ struct Context {
 	int location_texRandom;
 
 	bool ssao_enable = true;
+	double ssao_tier_ms[4] = { 0, 0, 0, 0 }; // GPU time of whole viewport paint, by Household::SSAO_* tier
+	int ssao_tier_frames[4] = { 0, 0, 0, 0 };
 	shared_ptr<QGLShaderProgram> program_hbao_calc;
 	shared_ptr<QGLShaderProgram> program_calc_blur;
 
@@ -127,6 +239,10 @@ struct Context {
 	int location_xywh;
 	int location_zpos;
 	shared_ptr<QGLShaderProgram> program_hud;
+	int location_plot_xywh;
+	int location_plot_channel;
+	int location_plot_head;
+	shared_ptr<QGLShaderProgram> program_hud_plot;
 
 	float pure_color_opacity = 1.0;
 
@@ -137,8 +253,31 @@ struct Context {
 	void load_missing_textures();
 	bool need_load_missing_textures = true;
 
-	int cached_bind_texture(const std::string& image_fn);
-	std::map<std::string, int> bind_cache;
+	shared_ptr<Texture> cached_bind_texture(const std::string& image_fn);
+	std::map<std::string, shared_ptr<Texture>> bind_cache;
+
+	// Residency: class geometry and textures are evicted least recently used first when
+	// over World::residency_budget_gpu, and uploaded again next time they are drawn.
+	uint64_t frame_n = 0;
+	uint64_t residency_checked_frame = 0;
+	bool residency_dirty = false;
+	std::list<weak_ptr<Household::Shape>> resident_shapes; // lower detail copies of meshes share VAO with best detail, all of them are here
+	void residency_track(const shared_ptr<Household::Shape>& shape);
+	size_t residency_gpu_bytes = 0;
+	size_t residency_cpu_bytes = 0;
+	int residency_evicted_geometry = 0;
+	int residency_evicted_textures = 0;
+	int residency_released_cpu = 0;
+	int residency_reloaded_geometry = 0;
+	int residency_reloaded_textures = 0;
+	void residency_enforce();
+	void residency_sweep();
+
+	// sets not referenced by any viewport are free to borrow
+	std::map<std::tuple<int, int, uint32_t>, std::vector<shared_ptr<RenderTargets>>> render_targets_pool;
+	shared_ptr<RenderTargets> render_targets_borrow(int W, int H, uint32_t attachments);
+	void render_targets_trim(); // free sets nobody borrowed for a while, left from resized viewports
+	size_t render_targets_bytes = 0;
 
 	shared_ptr<struct UsefulStuff> useful = 0;
 	void initGL();
@@ -163,8 +302,12 @@ public:
 	double side, near, far, hfov;
 	QMatrix4x4 modelview;
 	QMatrix4x4 modelview_inverse_transpose;
+	QMatrix4x4 last_projection; // parts of modelview, for reconstruction from depth
+	QMatrix4x4 last_view;
 
 	int  ssao_debug = 0;
+	int  ssao_quality = Household::SSAO_FULL;
+	bool ssao_temporal = false; // keep last AO while camera barely moves, recalculated at least every SSAO_TEMPORAL_MAX_REUSE frames
 	bool ortho = false;
 	bool blur = false;
 	int samples = 1;
@@ -180,7 +323,10 @@ public:
 	float ssao_bias      = 0.8;
 
 	ContextViewport(const shared_ptr<Context>& cx, int W, int H, double near, double far, double hfov);
+	~ContextViewport();
 
+	// from targets, valid between targets_borrow() and targets_release()
+	shared_ptr<RenderTargets> targets;
 	shared_ptr<Framebuffer> fbuf_scene;
 	shared_ptr<Framebuffer> fbuf_depthlinear;
 	shared_ptr<Framebuffer> fbuf_viewnormal;
@@ -198,6 +344,25 @@ public:
 	shared_ptr<Texture> hbao2_depthview[HBAO_RANDOM_ELEMENTS];
 	shared_ptr<Texture> hbao2_resultarray;
 
+	// AO rendered into texture: half resolution or temporal reuse
+	int ao_downsample = 0;
+	int ao_W = 0, ao_H = 0;
+	shared_ptr<Framebuffer> fbuf_ao;
+	shared_ptr<Texture>     tex_ao;
+	shared_ptr<Framebuffer> fbuf_ao_depthlinear;
+	shared_ptr<Texture>     tex_ao_depthlinear;
+	bool ao_valid = false;
+	int  ao_reused = 0;
+	QMatrix4x4 ao_modelview;
+
+	// organized point cloud, one point per (1 << shift) block of W x H, see pointcloud_paint()
+	int pc_W = 0, pc_H = 0;
+	shared_ptr<Framebuffer> fbuf_pointcloud;
+	shared_ptr<Texture>     tex_pointcloud;
+
+	GLuint timer_query = 0;
+	int timer_query_tier = -1; // query issued, result collected on next paint to avoid stall
+
 	QImage              hud_image;
 	shared_ptr<Texture> hud_texture;
 	shared_ptr<VAO>     hud_vao;
@@ -207,16 +372,24 @@ public:
 	int  hud_print_score(const std::string& score);
 	void hud_print(const QRect& r, const QString& msg_text, uint32_t bg, uint32_t fg, Qt::Alignment a, bool big_font);
 	void hud_update_finish();
+	void hud_plot(const QRect& r, const HudHistory& hist, int channel);
 
+	void targets_borrow();  // paint() does it as needed
+	void targets_release(); // camera calls it after reading pixels, shared set can be painted over by next viewport
 	void paint(float user_x, float user_y, float user_z, float wheel, float zrot, float xrot, Household::Camera* camera, int floor_visible, uint32_t view_options, float ruler_size);
+	bool pointcloud_paint(int shift, bool world_frame, bool have_labels); // after paint(), leaves result bound for glReadPixels()
 private:
-	void _depthlinear_init();
-	void _depthlinear_paint(int sample_idx);
-	void _hbao_prepare(const float* proj_matrix);
-	void _ssao_run(int sampleIdx);
+	void _depthlinear_paint(int sample_idx, int downsample);
+	void _hbao_prepare(const float* proj_matrix, int downsample);
+	void _ssao_run(int sampleIdx, bool to_texture);
+	void _ao_texture_init(int downsample);
+	void _ssao_apply();
+	int  _ssao_paint(const QMatrix4x4& projection);
+	void _timer_collect();
 	void _texture_paint(GLuint h);
 	int  _objects_loop(int floor_visible, uint32_t view_options);
-	void _render_single_object(const shared_ptr<Household::ShapeDetailLevels>& m, uint32_t f, int detail, const QMatrix4x4& at_pos);
+	void _collect_single_object(const shared_ptr<Household::ShapeDetailLevels>& m, uint32_t f, int detail, const btTransform& at_pos, uint8_t metaclass, uint32_t instance_id);
+	void _draw_packets();
 };
 
 extern void opengl_init_before_app(const boost::shared_ptr<Household::World>& wref);
@@ -19,45 +19,14 @@ namespace SimpleRender {
 using namespace Household;
 using namespace nv_math;
 
-void ContextViewport::_depthlinear_init()
+void ContextViewport::_depthlinear_paint(int sample_idx, int downsample)
 {
-	if (samples > 1) {
-//		tex_color.reset(new Texture());
-//		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, tex_color->handle);
-//		glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, GL_RGBA8, W, H, GL_FALSE);
-//		glBindTexture (GL_TEXTURE_2D_MULTISAMPLE, 0);
-//		tex_depthstencil.reset(new Texture());
-//		glBindTexture (GL_TEXTURE_2D_MULTISAMPLE, tex_depthstencil->handle);
-//		glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, GL_DEPTH24_STENCIL8, W, H, GL_FALSE);
-//		glBindTexture (GL_TEXTURE_2D_MULTISAMPLE, 0);
+	if (downsample==1) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbuf_depthlinear->handle); // to framebuf
 	} else {
-		tex_color.reset(new Texture());
-		glBindTexture(GL_TEXTURE_2D, tex_color->handle);
-		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, W, H);
-		glBindTexture(GL_TEXTURE_2D, 0);
-		tex_depthstencil.reset(new Texture());
-		glBindTexture(GL_TEXTURE_2D, tex_depthstencil->handle);
-		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, W, H);
-		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbuf_ao_depthlinear->handle);
+		glViewport(0,0,ao_W,ao_H);
 	}
-
-	tex_depthlinear.reset(new Texture());
-	glBindTexture(GL_TEXTURE_2D, tex_depthlinear->handle);
-	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, W, H);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	fbuf_depthlinear.reset(new Framebuffer());
-	glBindFramebuffer(GL_FRAMEBUFFER, fbuf_depthlinear->handle);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex_depthlinear->handle, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-void ContextViewport::_depthlinear_paint(int sample_idx)
-{
-	glBindFramebuffer(GL_FRAMEBUFFER, fbuf_depthlinear->handle); // to framebuf
 	if (samples > 1) {
 //		glUseProgram(cx->program_depth_linearize_msaa->programId());
 //		glUniform4f(0, near*far, near-far, far, ortho ? 0.0f : 1.0f);
@@ -69,6 +38,7 @@ void ContextViewport::_depthlinear_paint(int sample_idx)
 	} else {
 		glUseProgram(cx->program_depth_linearize->programId());
 		glUniform4f(cx->location_clipInfo, near*far, near-far, far, ortho ? 0.0f : 1.0f);
+		glUniform1i(cx->location_downsample, downsample);
 		//location_inputTexture
 		// MAC
 		glBindVertexArray(cx->ruler_vao->handle);
@@ -80,6 +50,7 @@ void ContextViewport::_depthlinear_paint(int sample_idx)
 	glUseProgram(0);
 	glBindVertexArray(0);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0,0,W,H);
 }
 
 struct UsefulStuff {
@@ -96,6 +67,33 @@ bool Context::_hbao_init()
 	}
 	program_depth_linearize->link(); // always returns true :(
 	location_clipInfo = program_depth_linearize->uniformLocation("clipInfo");
+	location_downsample = program_depth_linearize->uniformLocation("downsample");
+
+	program_ssao_upsample = load_program("fullscreen_triangle.vert.glsl", "", "ssao_upsample.frag.glsl", 0, 0, "#version 410\n");
+	if (!program_ssao_upsample->log().isEmpty()) {
+		fprintf(stderr, "Roboschool built-in render compiled with shadows, but SSAO shaders didn't load (3)\n");
+		return false;
+	}
+	program_ssao_upsample->link();
+	location_upsample_texAO = program_ssao_upsample->uniformLocation("texAO");
+	location_upsample_texLowDepth = program_ssao_upsample->uniformLocation("texLowDepth");
+	location_upsample_texFullDepth = program_ssao_upsample->uniformLocation("texFullDepth");
+	location_upsample_downsample = program_ssao_upsample->uniformLocation("downsample");
+
+	program_pointcloud = load_program("fullscreen_triangle.vert.glsl", "", "pointcloud.frag.glsl", 0, 0, "#version 410\n");
+	if (!program_pointcloud->log().isEmpty()) {
+		fprintf(stderr, "Roboschool built-in render compiled with shadows, but point cloud shader didn't load\n");
+		program_pointcloud.reset(); // not required for SSAO itself
+	} else {
+		program_pointcloud->link();
+		location_pointcloud_texLinearDepth = program_pointcloud->uniformLocation("texLinearDepth");
+		location_pointcloud_texDepth = program_pointcloud->uniformLocation("texDepth");
+		location_pointcloud_texLabels = program_pointcloud->uniformLocation("texLabels");
+		location_pointcloud_projInfo = program_pointcloud->uniformLocation("projInfo");
+		location_pointcloud_to_output = program_pointcloud->uniformLocation("to_output");
+		location_pointcloud_shift = program_pointcloud->uniformLocation("shift");
+		location_pointcloud_have_labels = program_pointcloud->uniformLocation("have_labels");
+	}
 
 	program_hbao_calc = load_program("fullscreen_triangle.vert.glsl", "", "ssao_hbao.frag.glsl", 0, 0, "#version 410\n#define AO_DEINTERLEAVED 0\n#define AO_BLUR 0\n#define AO_LAYERED 0\n");
 	if (!program_hbao_calc->log().isEmpty()) {
@@ -144,6 +142,7 @@ bool Context::_hbao_init()
 	hbao_random.reset(new Texture());
 	glBindTexture(GL_TEXTURE_2D_ARRAY, hbao_random->handle);
 	glTexStorage3D (GL_TEXTURE_2D_ARRAY,1,GL_RGBA16_SNORM,HBAO_RANDOM_SIZE,HBAO_RANDOM_SIZE,MAX_SAMPLES);
+	hbao_random->bytes = 8*HBAO_RANDOM_SIZE*HBAO_RANDOM_SIZE*MAX_SAMPLES; // views below share it
 	glTexSubImage3D(GL_TEXTURE_2D_ARRAY,0,0,0,0, HBAO_RANDOM_SIZE,HBAO_RANDOM_SIZE,MAX_SAMPLES,GL_RGBA,GL_SHORT,hbaoRandomShort);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
@@ -161,7 +160,7 @@ bool Context::_hbao_init()
 	return true;
 }
 
-void ContextViewport::_hbao_prepare(const float* proj_matrix)
+void ContextViewport::_hbao_prepare(const float* proj_matrix, int downsample)
 {
 #if 0
 	float p1, p2, p3, testy;
@@ -188,13 +187,13 @@ void ContextViewport::_hbao_prepare(const float* proj_matrix)
 		cx->useful->hbaoUbo.projInfo[1] =  20.0f / ( P[4*1+1]);      // ((y) * T - B)
 		cx->useful->hbaoUbo.projInfo[2] = -( 1.0f + P[4*3+0]) / P[4*0+0]; // L
 		cx->useful->hbaoUbo.projInfo[3] = -( 1.0f - P[4*3+1]) / P[4*1+1]; // B
-		projScale = float(side) / cx->useful->hbaoUbo.projInfo[1];
+		projScale = float(side/downsample) / cx->useful->hbaoUbo.projInfo[1];
 	} else {
 		cx->useful->hbaoUbo.projInfo[0] =  2.0f / (P[4*0+0]);       // (x) * (R - L)/N
 		cx->useful->hbaoUbo.projInfo[1] =  2.0f / (P[4*1+1]);       // (y) * (T - B)/N
 		cx->useful->hbaoUbo.projInfo[2] = -( 1.0f - P[4*2+0]) / P[4*0+0]; // L/N
 		cx->useful->hbaoUbo.projInfo[3] = -( 1.0f + P[4*2+1]) / P[4*1+1]; // B/N
-		projScale = float(side) / (tanf(hfov * nv_to_rad * 0.5f) * 2.0f);
+		projScale = float(side/downsample) / (tanf(hfov * nv_to_rad * 0.5f) * 2.0f);
 	}
 
 	// radius
@@ -208,14 +207,16 @@ void ContextViewport::_hbao_prepare(const float* proj_matrix)
 	cx->useful->hbaoUbo.NDotVBias = std::min(std::max(0.0f, ssao_bias), 1.0f);
 	cx->useful->hbaoUbo.AOMultiplier = 1.0f / (1.0f - cx->useful->hbaoUbo.NDotVBias);
 
-	// resolution
-	int quarterW = ((W+3)/4);
-	int quarterH = ((H+3)/4);
+	// resolution, AO is calculated at
+	int aoW = downsample==1 ? W : ao_W;
+	int aoH = downsample==1 ? H : ao_H;
+	int quarterW = ((aoW+3)/4);
+	int quarterH = ((aoH+3)/4);
 
 	cx->useful->hbaoUbo.InvQuarterResolution[0] = 1.0f/float(quarterW);
 	cx->useful->hbaoUbo.InvQuarterResolution[1] = 1.0f/float(quarterH);
-	cx->useful->hbaoUbo.InvFullResolution[0] = 1.0f/float(W);
-	cx->useful->hbaoUbo.InvFullResolution[1] = 1.0f/float(H);
+	cx->useful->hbaoUbo.InvFullResolution[0] = 1.0f/float(aoW);
+	cx->useful->hbaoUbo.InvFullResolution[1] = 1.0f/float(aoH);
 
 	for (int i = 0; i < HBAO_RANDOM_ELEMENTS; i++){
 		cx->useful->hbaoUbo.float2Offsets[4*i+0] = float(i % 4) + 0.5f;
@@ -229,11 +230,16 @@ void ContextViewport::_hbao_prepare(const float* proj_matrix)
 	}
 }
 
-void ContextViewport::_ssao_run(int sampleIdx)
+void ContextViewport::_ssao_run(int sampleIdx, bool to_texture)
 {
 	if (blur) {
 		glBindFramebuffer(GL_FRAMEBUFFER, fbuf_hbao_calc->handle);
 		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	} else if (to_texture) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbuf_ao->handle);
+		glViewport(0,0,ao_W,ao_H);
+		glDisable(GL_DEPTH_TEST);
+		glDisable(GL_BLEND);
 	} else {
 		glBindFramebuffer(GL_FRAMEBUFFER, fbuf_scene->handle);
 		glDisable(GL_DEPTH_TEST);
@@ -275,7 +281,7 @@ void ContextViewport::_ssao_run(int sampleIdx)
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, cx->hbao_randomview[sampleIdx]->handle);
 	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, tex_depthlinear->handle);
+	glBindTexture(GL_TEXTURE_2D, (to_texture && ao_downsample!=1) ? tex_ao_depthlinear->handle : tex_depthlinear->handle);
 
 	glDrawArrays(GL_TRIANGLES,0,3);
 
@@ -292,8 +298,200 @@ void ContextViewport::_ssao_run(int sampleIdx)
 	glDisable(GL_BLEND);
 	glDisable(GL_SAMPLE_MASK);
 	glSampleMaski(0, ~0);
+	glViewport(0,0,W,H);
 
 	cx->program_hbao_calc->release();
 }
 
+void ContextViewport::_ao_texture_init(int downsample)
+{
+	ao_downsample = downsample;
+	ao_W = (W + downsample-1) / downsample;
+	ao_H = (H + downsample-1) / downsample;
+	ao_valid = false;
+
+	tex_ao.reset(new Texture());
+	glBindTexture(GL_TEXTURE_2D, tex_ao->handle);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, ao_W, ao_H);
+	tex_ao->bytes = ao_W*ao_H;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	fbuf_ao.reset(new Framebuffer());
+	glBindFramebuffer(GL_FRAMEBUFFER, fbuf_ao->handle);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex_ao->handle, 0);
+
+	tex_ao_depthlinear.reset();
+	fbuf_ao_depthlinear.reset();
+	if (downsample != 1) {
+		tex_ao_depthlinear.reset(new Texture());
+		glBindTexture(GL_TEXTURE_2D, tex_ao_depthlinear->handle);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, ao_W, ao_H);
+		tex_ao_depthlinear->bytes = 4*ao_W*ao_H;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		fbuf_ao_depthlinear.reset(new Framebuffer());
+		glBindFramebuffer(GL_FRAMEBUFFER, fbuf_ao_depthlinear->handle);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex_ao_depthlinear->handle, 0);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ContextViewport::_ssao_apply()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, fbuf_scene->handle);
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ZERO,GL_SRC_COLOR);
+
+	cx->program_ssao_upsample->bind();
+	glUniform1i(cx->location_upsample_texAO, 0);
+	glUniform1i(cx->location_upsample_texLowDepth, 1);
+	glUniform1i(cx->location_upsample_texFullDepth, 2);
+	glUniform1i(cx->location_upsample_downsample, ao_downsample);
+	glBindVertexArray(cx->ruler_vao->handle);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, tex_ao->handle);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, ao_downsample!=1 ? tex_ao_depthlinear->handle : tex_depthlinear->handle);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, tex_depthlinear->handle);
+
+	glDrawArrays(GL_TRIANGLES,0,3);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindVertexArray(0);
+	cx->program_ssao_upsample->release();
+
+	glEnable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+}
+
+bool ContextViewport::pointcloud_paint(int shift, bool world_frame, bool have_labels)
+{
+	if (!cx->program_pointcloud || !cx->program_depth_linearize) return false;
+	if (!fbuf_pointcloud || pc_W != (W >> shift) || pc_H != (H >> shift)) {
+		pc_W = W >> shift;
+		pc_H = H >> shift;
+		tex_pointcloud.reset(new Texture());
+		glBindTexture(GL_TEXTURE_2D, tex_pointcloud->handle);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, pc_W, pc_H); // float16 readback is converted by glReadPixels()
+		tex_pointcloud->bytes = 16*pc_W*pc_H;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		fbuf_pointcloud.reset(new Framebuffer());
+		glBindFramebuffer(GL_FRAMEBUFFER, fbuf_pointcloud->handle);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex_pointcloud->handle, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	_depthlinear_paint(0, 1); // last pass might have skipped AO (labels, depth only), so linear depth can be stale
+
+	// same as in _hbao_prepare(), perspective only: robot cameras are never ortho
+	const float* P = last_projection.constData();
+	float projInfo[4] = {
+		 2.0f / P[4*0+0],
+		 2.0f / P[4*1+1],
+		-(1.0f - P[4*2+0]) / P[4*0+0],
+		-(1.0f + P[4*2+1]) / P[4*1+1] };
+	QMatrix4x4 to_output;
+	if (world_frame) to_output = last_view.inverted();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbuf_pointcloud->handle);
+	glViewport(0,0,pc_W,pc_H);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	cx->program_pointcloud->bind();
+	glUniform1i(cx->location_pointcloud_texLinearDepth, 0);
+	glUniform1i(cx->location_pointcloud_texDepth, 1);
+	glUniform1i(cx->location_pointcloud_texLabels, 2);
+	glUniform4fv(cx->location_pointcloud_projInfo, 1, projInfo);
+	cx->program_pointcloud->setUniformValue(cx->location_pointcloud_to_output, to_output);
+	glUniform1i(cx->location_pointcloud_shift, shift);
+	glUniform1i(cx->location_pointcloud_have_labels, have_labels);
+	glBindVertexArray(cx->ruler_vao->handle);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, tex_depthlinear->handle);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, tex_depthstencil->handle);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, tex_color->handle);
+
+	glDrawArrays(GL_TRIANGLES,0,3);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindVertexArray(0);
+	cx->program_pointcloud->release();
+	glEnable(GL_DEPTH_TEST);
+	glViewport(0,0,W,H);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbuf_pointcloud->handle);
+	return true;
+}
+
+const int SSAO_TEMPORAL_MAX_REUSE = 8;
+const float SSAO_TEMPORAL_MAX_DELTA = 0.002; // max change of modelview matrix element
+
+int ContextViewport::_ssao_paint(const QMatrix4x4& projection)
+{
+	int tier = cx->ssao_enable ? ssao_quality : SSAO_OFF;
+	if (tier==SSAO_OFF) return SSAO_OFF;
+	if (tier==SSAO_FULL && !ssao_temporal) {
+		// AO multiplied straight into scene, no intermediate texture
+		_hbao_prepare(projection.data(), 1);
+		_depthlinear_paint(0, 1);
+		_ssao_run(0, false);
+		return SSAO_FULL;
+	}
+
+	int downsample = tier==SSAO_HALF ? 2 : 1;
+	if (!fbuf_ao || ao_downsample != downsample)
+		_ao_texture_init(downsample);
+
+	bool reuse = ssao_temporal && ao_valid && ao_reused < SSAO_TEMPORAL_MAX_REUSE;
+	for (int i=0; i<16 && reuse; i++)
+		reuse = fabs(modelview.constData()[i] - ao_modelview.constData()[i]) < SSAO_TEMPORAL_MAX_DELTA;
+
+	if (downsample!=1 || !reuse)
+		_depthlinear_paint(0, 1); // cheap, and upsample needs full resolution depth of this frame
+	if (reuse) {
+		ao_reused++;
+		tier = SSAO_REUSED;
+	} else {
+		ao_valid = true;
+		ao_reused = 0;
+		ao_modelview = modelview;
+		_hbao_prepare(projection.data(), downsample);
+		if (downsample!=1) _depthlinear_paint(0, downsample);
+		_ssao_run(0, true);
+	}
+	_ssao_apply();
+	return tier;
+}
+
+void ContextViewport::_timer_collect()
+{
+	if (timer_query_tier < 0) return;
+	GLint available = 0;
+	glGetQueryObjectiv(timer_query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) return; // rare, then this frame is not measured
+	GLuint64 ns = 0;
+	glGetQueryObjectui64v(timer_query, GL_QUERY_RESULT, &ns);
+	cx->ssao_tier_ms[timer_query_tier] += ns / 1000000.0;
+	cx->ssao_tier_frames[timer_query_tier] += 1;
+	timer_query_tier = -1;
+}
+
 } // namespace
@@ -0,0 +1,106 @@
+#include "rollout.h"
+#include <stdexcept>
+#include <algorithm>
+#include <string>
+#include <cmath>
+
+namespace Household {
+
+// same as Pose.rpy() in python
+static void roll_pitch(const btTransform& tr, float* roll, float* pitch)
+{
+	btQuaternion q = tr.getRotation();
+	btScalar qx = q.x(), qy = q.y(), qz = q.z(), qw = q.w();
+	btScalar sqw = qw*qw;
+	btScalar sqx = qx*qx;
+	btScalar sqy = qy*qy;
+	btScalar sqz = qz*qz;
+	btScalar t2 = -2.0 * (qx*qz - qy*qw) / (sqx + sqy + sqz + sqw);
+	t2 = t2 >  1.0f ?  1.0f : t2;
+	t2 = t2 < -1.0f ? -1.0f : t2;
+	*roll  = atan2(2.0 * (qy*qz + qx*qw), (-sqx - sqy + sqz + sqw));
+	*pitch = asin(t2);
+}
+
+int RolloutPredicate::check(World* world) const
+{
+	for (size_t i=0; i<any.size(); i++) {
+		const RolloutCondition& c = any[i];
+		shared_ptr<Thingy> part = c.part.lock();
+		shared_ptr<Joint> joint = c.joint.lock();
+		bool hit = false;
+		float roll, pitch;
+		switch (c.type) {
+		case RolloutCondition::Z_BELOW:
+			hit = part && part->bullet_position.getOrigin().z() < c.threshold*SCALE;
+			break;
+		case RolloutCondition::Z_ABOVE:
+			hit = part && part->bullet_position.getOrigin().z() > c.threshold*SCALE;
+			break;
+		case RolloutCondition::ABS_PITCH_ABOVE:
+		case RolloutCondition::ABS_ROLL_ABOVE:
+			if (!part) break;
+			roll_pitch(part->bullet_position, &roll, &pitch);
+			hit = std::fabs(c.type==RolloutCondition::ABS_PITCH_ABOVE ? pitch : roll) > c.threshold;
+			break;
+		case RolloutCondition::JOINT_AT_LIMIT:
+			if (!joint || !joint->joint_has_limits || joint->joint_limit1 > joint->joint_limit2) break;
+			hit =
+				joint->joint_current_position <= joint->joint_limit1 + c.threshold ||
+				joint->joint_current_position >= joint->joint_limit2 - c.threshold;
+			break;
+		case RolloutCondition::CONTACT_METACLASS:
+			if (!part) break;
+			for (const shared_ptr<Thingy>& other: world->bullet_contact_list(part)) {
+				if (c.metaclass==0 || (other->klass && (other->klass->metaclass & c.metaclass))) {
+					hit = true;
+					break;
+				}
+			}
+			break;
+		case RolloutCondition::CONTACT_NAME:
+			if (!part) break;
+			for (const shared_ptr<Thingy>& other: world->bullet_contact_list(part)) {
+				if (other->name==c.other_name) {
+					hit = true;
+					break;
+				}
+			}
+			break;
+		}
+		if (hit) return i;
+	}
+	return -1;
+}
+
+int rollout(World* world, int k, const RolloutActions& actions, const RolloutPredicate& predicate, int* stopped_by)
+{
+	int n = actions.joints.size();
+	int a = actions.actions.size();
+	bool held = a==n;
+	if (!held && a != k*n)
+		throw std::runtime_error("rollout(): need " + std::to_string(n) + " actions to hold, or " + std::to_string(k*n) + " for each of " + std::to_string(k) + " steps, got " + std::to_string(a));
+	if (actions.frame_skip < 1) throw std::runtime_error("rollout(): frame_skip must be positive");
+
+	*stopped_by = -1;
+	int step = 0;
+	while (step < k) {
+		const float* act = actions.actions.data() + (held ? 0 : step*n);
+		if (!held || step==0) {
+			for (int i=0; i<n; i++) {
+				shared_ptr<Joint> j = actions.joints[i].joint.lock();
+				if (!j) continue;
+				float x = std::isfinite(act[i]) ? std::max(-1.0f, std::min(+1.0f, act[i])) : 0;
+				j->set_motor_torque(actions.joints[i].scale*x); // torque is repeated by bullet_step() while held
+			}
+		}
+		world->bullet_step(actions.frame_skip);
+		world->recording_tick();
+		step++;
+		*stopped_by = predicate.check(world);
+		if (*stopped_by != -1) break;
+	}
+	return step;
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "household.h"
+
+namespace Household {
+
+// World.rollout(k, actions, predicate) in python: up to k env steps without returning to python,
+// stops early when predicate is true. Replaces step loop of open-loop evaluation and action repeat.
+
+struct RolloutActJoint {
+	boost::weak_ptr<Joint> joint;
+	float scale; // set_motor_torque(scale*clip(a, -1, +1)), as apply_action() in gym_forward_walker.py
+};
+
+struct RolloutActions {
+	int frame_skip = 4;
+	std::vector<RolloutActJoint> joints;
+	std::vector<float> actions; // joints.size() held for all steps, or k*joints.size() one per step
+};
+
+struct RolloutCondition {
+	enum { Z_BELOW, Z_ABOVE, ABS_PITCH_ABOVE, ABS_ROLL_ABOVE, JOINT_AT_LIMIT, CONTACT_METACLASS, CONTACT_NAME };
+	int type;
+	boost::weak_ptr<Thingy> part;
+	boost::weak_ptr<Joint> joint;
+	float threshold;    // z, angle, or distance to limit
+	uint8_t metaclass;  // CONTACT_METACLASS: any of these bits on other part, 0 is any contact
+	std::string other_name; // CONTACT_NAME: other part has this name, as foot_ground_object_names in python
+};
+
+struct RolloutPredicate {
+	std::vector<RolloutCondition> any; // true if any condition is true
+	int check(World* world) const;     // index of first true condition, or -1
+};
+
+// Returns number of steps done, *stopped_by is condition that stopped it, or -1 if all k steps done
+int rollout(World* world, int k, const RolloutActions& actions, const RolloutPredicate& predicate, int* stopped_by);
+
+}
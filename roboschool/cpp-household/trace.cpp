@@ -0,0 +1,109 @@
+#include "trace.h"
+#include <vector>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+namespace Household {
+
+std::atomic<bool> trace_on(false);
+
+const int TRACE_BUFFER_SPANS = 1 << 16; // per thread, 1.5M of memory, allocated on first span in that thread
+
+struct TraceEvent {
+	const char* name;
+	uint64_t t0, t1;
+};
+
+// Written by owner thread only. Owner resets count before it publishes new generation, so
+// trace_stop() that sees current generation never reads spans of previous trace.
+struct TraceBuffer {
+	int tid;
+	std::atomic<uint32_t> generation;
+	std::atomic<int> count;
+	std::atomic<int> dropped;
+	TraceEvent spans[TRACE_BUFFER_SPANS];
+	TraceBuffer(): generation(0), count(0), dropped(0)  { }
+};
+
+static std::mutex trace_mutex; // registration of buffers, start, stop
+static std::vector<TraceBuffer*> trace_buffers; // never freed, threads in pools usually live long anyway
+static std::atomic<uint32_t> trace_generation(0);
+static std::string trace_path;
+static uint64_t trace_t0;
+static thread_local TraceBuffer* trace_my_buffer = 0;
+
+void trace_record(const char* name, uint64_t t0_ns, uint64_t t1_ns)
+{
+	TraceBuffer* b = trace_my_buffer;
+	if (!b) {
+		b = new TraceBuffer;
+		std::lock_guard<std::mutex> lock(trace_mutex);
+		b->tid = trace_buffers.size() + 1;
+		trace_buffers.push_back(b);
+		trace_my_buffer = b;
+	}
+	uint32_t g = trace_generation.load(std::memory_order_acquire);
+	if (b->generation.load(std::memory_order_relaxed) != g) {
+		b->count.store(0, std::memory_order_relaxed);
+		b->dropped.store(0, std::memory_order_relaxed);
+		b->generation.store(g, std::memory_order_release);
+	}
+	int n = b->count.load(std::memory_order_relaxed);
+	if (n >= TRACE_BUFFER_SPANS) {
+		b->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	b->spans[n].name = name;
+	b->spans[n].t0 = t0_ns;
+	b->spans[n].t1 = t1_ns;
+	b->count.store(n+1, std::memory_order_release);
+}
+
+void trace_start(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	trace_path = path;
+	trace_t0 = trace_now_ns();
+	trace_generation.fetch_add(1);
+	trace_on.store(true);
+}
+
+int trace_stop()
+{
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	if (!trace_on.load()) throw std::runtime_error("stop_trace(): trace is not started");
+	trace_on.store(false);
+	FILE* f = fopen(trace_path.c_str(), "w");
+	if (!f) throw std::runtime_error("cannot write trace '" + trace_path + "': " + strerror(errno));
+	int pid = getpid();
+	uint32_t g = trace_generation.load();
+	int written = 0;
+	int dropped = 0;
+	const char* sep = "";
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (TraceBuffer* b: trace_buffers) {
+		if (b->generation.load(std::memory_order_acquire) != g) continue;
+		int n = b->count.load(std::memory_order_acquire);
+		dropped += b->dropped.load();
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%i,\"tid\":%i,\"args\":{\"name\":\"thread %i\"}}", sep, pid, b->tid, b->tid);
+		sep = ",\n";
+		for (int i=0; i<n; i++) {
+			const TraceEvent& e = b->spans[i];
+			if (e.t0 < trace_t0) continue; // span started before trace
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%i,\"tid\":%i,\"ts\":%0.3f,\"dur\":%0.3f}",
+				e.name, pid, b->tid, (e.t0 - trace_t0)/1000.0, (e.t1 - e.t0)/1000.0);
+			written++;
+		}
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(f);
+	if (dropped)
+		fprintf(stderr, "trace '%s': %i spans dropped, buffer holds %i spans per thread\n", trace_path.c_str(), dropped, TRACE_BUFFER_SPANS);
+	return written;
+}
+
+}
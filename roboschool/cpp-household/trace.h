@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <chrono>
+
+namespace Household {
+
+// Spans in Chrome trace format (chrome://tracing, ui.perfetto.dev), World.start_trace(path) and
+// World.stop_trace() in python. Process wide: spans of all worlds and all threads go to one file.
+// Each thread appends to its own buffer, no locks, nothing is formatted until stop_trace().
+// When tracing is off, a span costs one relaxed atomic load.
+
+extern std::atomic<bool> trace_on;
+
+void trace_start(const std::string& path);
+int  trace_stop(); // writes file, returns number of spans written
+void trace_record(const char* name, uint64_t t0_ns, uint64_t t1_ns); // name must be a string literal
+
+inline uint64_t trace_now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct TraceSpan {
+	const char* name;
+	uint64_t t0 = 0;
+	TraceSpan(const char* name): name(0)  { begin(name); }
+	~TraceSpan()  { end(); }
+	void begin(const char* new_name) // ends current span, if any, and starts another one
+	{
+		end();
+		if (!trace_on.load(std::memory_order_relaxed)) return;
+		name = new_name;
+		t0 = trace_now_ns();
+	}
+	void end()
+	{
+		if (!name) return;
+		trace_record(name, t0, trace_now_ns());
+		name = 0;
+	}
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SPAN(name) Household::TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+}
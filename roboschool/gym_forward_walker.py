@@ -42,6 +42,32 @@ class RoboschoolForwardWalker(SharedMemoryClientEnv):
         for n,j in enumerate(self.ordered_joints):
             j.set_motor_torque( self.power*j.power_coef*float(np.clip(a[n], -1, +1)) )
 
+    def rollout_actions(self):
+        "Same as apply_action(), for World.rollout()"
+        acts = cpp_household.RolloutActions(self.scene.frame_skip)
+        for j in self.ordered_joints:
+            acts.joint_add(j, self.power*j.power_coef)
+        return acts
+
+    def rollout_predicate(self):
+        "True where alive_bonus() is negative, override together with alive_bonus()"
+        return cpp_household.RolloutPredicate()
+
+    def native_rollout(self, k, a):
+        """
+        Up to k steps without returning to python, a is one action held for all steps, or k actions.
+        Stops early if robot dies. No rewards, use it for open-loop evaluation or action repeat.
+        Returns (steps_done, died).
+        """
+        assert not self.scene.multiplayer
+        acts = self.rollout_actions()
+        acts.set(np.ascontiguousarray(a, dtype=np.float32))
+        steps, stopped_by = self.scene.cpp_world.rollout(k, acts, self.rollout_predicate())
+        self.frame += steps
+        self.calc_state()
+        self.potential = self.calc_potential()
+        return steps, stopped_by >= 0
+
     def calc_state(self):
         j = np.array([j.current_relative_position() for j in self.ordered_joints], dtype=np.float32).flatten()
         # even elements [0::2] position, scaled to -1..+1 between limits
@@ -17,6 +17,11 @@ class RoboschoolHopper(RoboschoolForwardWalkerMujocoXML):
         RoboschoolForwardWalkerMujocoXML.__init__(self, "hopper.xml", "torso", action_dim=3, obs_dim=15, power=0.75)
     def alive_bonus(self, z, pitch):
         return +1 if z > 0.8 and abs(pitch) < 1.0 else -1
+    def rollout_predicate(self):
+        p = cpp_household.RolloutPredicate()
+        p.z_below(self.robot_body, 0.8)
+        p.abs_pitch_above(self.robot_body, 1.0)
+        return p
 
 class RoboschoolWalker2d(RoboschoolForwardWalkerMujocoXML):
     foot_list = ["foot", "foot_left"]
@@ -24,6 +29,11 @@ class RoboschoolWalker2d(RoboschoolForwardWalkerMujocoXML):
         RoboschoolForwardWalkerMujocoXML.__init__(self, "walker2d.xml", "torso", action_dim=6, obs_dim=22, power=0.40)
     def alive_bonus(self, z, pitch):
         return +1 if z > 0.8 and abs(pitch) < 1.0 else -1
+    def rollout_predicate(self):
+        p = cpp_household.RolloutPredicate()
+        p.z_below(self.robot_body, 0.8)
+        p.abs_pitch_above(self.robot_body, 1.0)
+        return p
     def robot_specific_reset(self):
         RoboschoolForwardWalkerMujocoXML.robot_specific_reset(self)
         for n in ["foot_joint", "foot_left_joint"]:
@@ -36,6 +46,13 @@ class RoboschoolHalfCheetah(RoboschoolForwardWalkerMujocoXML):
     def alive_bonus(self, z, pitch):
         # Use contact other than feet to terminate episode: due to a lot of strange walks using knees
         return +1 if np.abs(pitch) < 1.0 and not self.feet_contact[1] and not self.feet_contact[2] and not self.feet_contact[4] and not self.feet_contact[5] else -1
+    def rollout_predicate(self):
+        p = cpp_household.RolloutPredicate()
+        p.abs_pitch_above(self.robot_body, 1.0)
+        for name in ["fshin", "fthigh", "bshin", "bthigh"]:
+            for ground in self.foot_ground_object_names:
+                p.contact_name(self.parts[name], ground)  # as feet_contact, leg on leg doesn't count
+        return p
     def robot_specific_reset(self):
         RoboschoolForwardWalkerMujocoXML.robot_specific_reset(self)
         self.jdict["bthigh"].power_coef = 120.0
@@ -51,6 +68,10 @@ class RoboschoolAnt(RoboschoolForwardWalkerMujocoXML):
         RoboschoolForwardWalkerMujocoXML.__init__(self, "ant.xml", "torso", action_dim=8, obs_dim=28, power=2.5)
     def alive_bonus(self, z, pitch):
         return +1 if z > 0.26 else -1  # 0.25 is central sphere rad, die if it scrapes the ground
+    def rollout_predicate(self):
+        p = cpp_household.RolloutPredicate()
+        p.z_below(self.robot_body, 0.26)
+        return p
 
 
 ## 3d Humanoid ##
@@ -111,5 +132,15 @@ class RoboschoolHumanoid(RoboschoolForwardWalkerMujocoXML):
         for i, m, power in zip(range(len(self.motors)), self.motors, self.motor_power):
             m.set_motor_torque( float(power*self.power*np.clip(a[i], -1, +1)) )
 
+    def rollout_actions(self):
+        acts = cpp_household.RolloutActions(self.scene.frame_skip)
+        for m, power in zip(self.motors, self.motor_power):
+            acts.joint_add(m, power*self.power)
+        return acts
+
     def alive_bonus(self, z, pitch):
         return +2 if z > 0.78 else -1   # 2 here because 17 joints produce a lot of electricity cost just from policy noise, living must be better than dying
+    def rollout_predicate(self):
+        p = cpp_household.RolloutPredicate()
+        p.z_below(self.robot_body, 0.78)
+        return p
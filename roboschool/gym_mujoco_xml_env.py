@@ -74,6 +74,13 @@ class RoboschoolMujocoXmlEnv(gym.Env):
         self.camera = self.scene.cpp_world.new_camera_free_float(self.VIDEO_W, self.VIDEO_H, "video_camera")
         return s
 
+    def rgb_array_camera(self):
+        """
+        Camera ready to render rgb_array image, multiplayer server renders cameras of all players in one batch.
+        """
+        self.camera_adjust()
+        return self.camera
+
     def _render(self, mode, close):
         if close:
             return
@@ -81,8 +88,7 @@ class RoboschoolMujocoXmlEnv(gym.Env):
             self.scene.human_render_detected = True
             return self.scene.cpp_world.test_window()
         elif mode=="rgb_array":
-            self.camera_adjust()
-            rgb, _, _, _, _ = self.camera.render(False, False, False) # render_depth, render_labeling, print_timing)
+            rgb, _, _, _, _ = self.rgb_array_camera().render(False, False, False) # render_depth, render_labeling, print_timing)
             rendered_rgb = np.fromstring(rgb, dtype=np.uint8).reshape( (self.VIDEO_H,self.VIDEO_W,3) )
             return rendered_rgb
         else:
@@ -198,6 +198,27 @@ class RoboschoolPong(gym.Env, SharedMemoryClientEnv):
             self.scene.p1x.set_target_speed( -3*float(a[0]), 0.05, 7 )
             self.scene.p1y.set_target_speed(  3*float(a[1]), 0.05, 7 )
 
+    def native_bot_setup(self, bot):
+        """
+        Same observation as calc_state() and same actions as apply_action(), for cpp_household.BotPlayer.
+        Joints are loaded again on each episode_restart(), so call this after it.
+        """
+        sc = self.scene
+        if self.player_n==0:
+            obs = [(sc.p0x,1), (sc.p0y,1), (sc.p1x,1), (sc.p1y,1), (sc.ballx,1), (sc.bally,1)]
+            act = [(sc.p0x,+3), (sc.p0y,3)]
+        else:
+            obs = [(sc.p1x,-1), (sc.p1y,1), (sc.p0x,-1), (sc.p0y,1), (sc.ballx,-1), (sc.bally,1)]
+            act = [(sc.p1x,-3), (sc.p1y,3)]
+        for j, sign in obs:
+            bot.obs_joint_add(j, sign, sign)
+        for j, scale in act:
+            bot.act_joint_add(j, scale, 0.05, 7)
+        bot.set_obs_extra(self.native_bot_obs_extra())
+
+    def native_bot_obs_extra(self):
+        return [(self.scene.timeout - self.scene.TIMEOUT) / self.scene.TIMEOUT]
+
     def _step(self, a):
         if not self.scene.multiplayer:
             self.apply_action(a)
@@ -216,14 +237,20 @@ class RoboschoolPong(gym.Env, SharedMemoryClientEnv):
 
         return state, sum(self.rewards), False, {}
 
+    def rgb_array_camera(self):
+        """
+        Camera ready to render rgb_array image, multiplayer server renders cameras of all players in one batch.
+        """
+        self.scene.camera_adjust()
+        return self.scene.camera
+
     def _render(self, mode, close):
         if close:
             return
         if mode=="human":
             return self.scene.cpp_world.test_window()
         elif mode=="rgb_array":
-            self.scene.camera_adjust()
-            rgb, _, _, _, _ = self.scene.camera.render(False, False, False) # render_depth, render_labeling, print_timing)
+            rgb, _, _, _, _ = self.rgb_array_camera().render(False, False, False) # render_depth, render_labeling, print_timing)
             rendered_rgb = np.fromstring(rgb, dtype=np.uint8).reshape( (self.VIDEO_H,self.VIDEO_W,3) )
             return rendered_rgb
         else:
@@ -38,15 +38,9 @@ elif len(sys.argv)==3:
     adversary_script = sys.argv[2]
 
     game       = roboschool.gym_pong.PongSceneMultiplayer()
-    gameserver = roboschool.multiplayer.SharedMemoryServer(game, game_server_guid, want_test_window=False)
-    # Shared memory files and pipes are ready here
-
-    run_adv = [sys.executable, adversary_script, game_server_guid, "0"]   # plays for player 0, connect your agent as player 1
-    print("EXEC %s" % " ".join(run_adv))
-    subprocess.Popen(run_adv)
-    # Adversary script must support two command line parameters: game_server_guid and player_n.
-    # Inside, it must call:
-    #    env.unwrapped.multiplayer(env, game_server_guid, int(player_n))
+    gameserver = roboschool.multiplayer.SharedMemoryServer(game, game_server_guid, want_test_window=False,
+        bots={0: ("RoboschoolPong-v1", adversary_script)})   # plays for player 0 inside this process, connect your agent as player 1
+    # Shared memory is ready here. Adversary script is not run, only its weights are used, see roboschool/native_policy.py
 
     gameserver.serve_forever()
 
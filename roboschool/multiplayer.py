@@ -1,9 +1,8 @@
-from roboschool.scene_abstract import SingleRobotEmptyScene
+from roboschool.scene_abstract import SingleRobotEmptyScene, cpp_household
 import numpy as np
-import os
 import gym
 
-MULTIPLAYER_FILES_DIR = "/tmp"
+MULTIPLAYER_CONNECT_TIMEOUT_MS = 60000
 
 class SharedMemoryClientEnv:
     """
@@ -17,19 +16,12 @@ class SharedMemoryClientEnv:
 
     def shmem_client_init(self, game_server_guid, player_n):
         """
-        This class maps files into memory:
-
-        /tmp/multiplayer_game_server_guid_player00_obs
-        /tmp/multiplayer_game_server_guid_player01_obs
-        ...
+        Server creates one shared memory segment for the whole game (see cpp-household/multiplayer.h),
+        each player has a slot in it: observations, actions, reward, video image, and sequence
+        counters used to pass commands and responses.
 
         These arrays allows server and client to have access to the same data, without a need to copy it.
-
-        This class also creates named pipes, that is used to inform other side when things happen (something
-        you can't do with shared memory):
-
-        /tmp/multiplayer_game_server_guid_player00_obsready
-
+        Waiting for other side is a short spin and then futex, no pipes and no string parsing.
         """
         assert isinstance(self.observation_space, gym.spaces.Box)
         assert isinstance(self.action_space, gym.spaces.Box)
@@ -38,11 +30,8 @@ class SharedMemoryClientEnv:
         assert("sh_obs" not in self.__dict__)
         self.game_server_guid = game_server_guid
         self.player_n = player_n
-        self.prefix = MULTIPLAYER_FILES_DIR + "/multiplayer_%s_player%02i" % (game_server_guid, player_n)
-        self.sh_pipe_actready_filename = self.prefix + "_actready"
-        self.sh_pipe_actready = os.open(self.sh_pipe_actready_filename, os.O_WRONLY)
-        self.sh_pipe_obsready_filename = self.prefix + "_obsready"
-        self.sh_pipe_obsready = open(self.sh_pipe_obsready_filename, 'rt')
+        self.sh_game = cpp_household.SharedMemoryGame(game_server_guid, MULTIPLAYER_CONNECT_TIMEOUT_MS)
+        assert player_n < self.sh_game.players
 
     def shmem_client_send_env_id(self):
         """
@@ -50,41 +39,40 @@ class SharedMemoryClientEnv:
         For example, Stadium supports Hopper and Ant.
 
         On server side, environment of the same type should be created. To do
-        that, we send env_id over pipe.
+        that, we send env_id in our slot.
 
-        Obervations, actions must have size matching that on server. So we open shared memory
-        files at this point, after server created those files based on knowledge it now has,
-        and sent "accepted" back here.
+        Obervations, actions must have size matching that on server. Server sets sizes
+        in our slot, based on knowledge it now has, and sends "A" (accepted) back here.
         """
-        os.write(self.sh_pipe_actready, (self.spec.id + "\n").encode("ascii"))
-        check = self.sh_pipe_obsready.readline()[:-1]
-        assert(check=="accepted")
-        self.sh_obs = np.memmap(self.prefix + "_obs",  mode="r+", shape=self.observation_space.shape, dtype=np.float32)
-        self.sh_act = np.memmap(self.prefix + "_act",  mode="r+", shape=self.action_space.shape, dtype=np.float32)
-        self.sh_rew = np.memmap(self.prefix + "_rew",  mode="r+", shape=(1,), dtype=np.float32)
-        self.sh_rgb = np.memmap(self.prefix + "_rgb",  mode="r+", shape=(self.VIDEO_H,self.VIDEO_W,3), dtype=np.uint8)
+        self.sh_game.set_env_id(self.player_n, self.spec.id)
+        check = self.sh_game.request(self.player_n, 'E', -1)
+        if check!='A':
+            raise ValueError("multiplayer server didn't accept env_id '%s', returned '%s'" % (self.spec.id, check))
+        obs_n, act_n, rgb_w, rgb_h = self.sh_game.sizes(self.player_n)
+        assert obs_n==np.prod(self.observation_space.shape) and act_n==np.prod(self.action_space.shape)
+        self.sh_obs = np.frombuffer(self.sh_game.obs(self.player_n), dtype=np.float32).reshape(self.observation_space.shape)
+        self.sh_act = np.frombuffer(self.sh_game.act(self.player_n), dtype=np.float32).reshape(self.action_space.shape)
+        self.sh_rgb = np.frombuffer(self.sh_game.rgb(self.player_n), dtype=np.uint8).reshape((rgb_h,rgb_w,3))
 
     def shmem_client_step(self, a):
         """
         [:] notion means to put data into existing array (shared memory), not create new array.
         """
         self.sh_act[:] = a
-        os.write(self.sh_pipe_actready, b'a\n')
-        check = self.sh_pipe_obsready.readline()[:-1]  # It blocks here, until server responds with "t" or "D" (tuple or tuple+done)
+        check = self.sh_game.request(self.player_n, 'a', -1)  # It blocks here, until server responds with "t" or "D" (tuple or tuple+done)
         if check=='t':  # tuple
             done = False
         elif check=='D':
             done = True
         else:
             raise ValueError("multiplayer server returned invalid string '%s', probably was shut down" % check)
-        return self.sh_obs, self.sh_rew[0], done, {}
+        return self.sh_obs, self.sh_game.rew(self.player_n), done, {}
 
     def shmem_client_reset(self):
         """
         Reset sends "R" and expects "o" for observations, if it sees something else, like "t", it means server is broken.
         """
-        os.write(self.sh_pipe_actready, b'R\n')
-        check = self.sh_pipe_obsready.readline()[:-1]
+        check = self.sh_game.request(self.player_n, 'R', -1)
         if check=='o':
             return self.sh_obs
         else:
@@ -97,8 +85,7 @@ class SharedMemoryClientEnv:
         if close:
             return
         if mode=="rgb_array":
-            os.write(self.sh_pipe_actready, b'G\n')
-            check = self.sh_pipe_obsready.readline()[:-1]
+            check = self.sh_game.request(self.player_n, 'G', -1)
             if check=='i':
                 return self.sh_rgb
             else:
@@ -131,33 +118,25 @@ class SharedMemoryPlayerAgent:
 
     It contains real env, controlled by appying commands from remote client.
     """
-    def __init__(self, scene, game_server_guid, player_n):
+    def __init__(self, scene, sh_game, player_n):
         """
-        It doesn't know env_id yet, it creates pipes and waits for client to send his env_id.
+        It doesn't know env_id yet, it waits for client to send his env_id.
         """
         self.scene = scene
-        assert isinstance(game_server_guid, str)
         assert isinstance(player_n, int)
         self.player_n = player_n
-        self.prefix = MULTIPLAYER_FILES_DIR + "/multiplayer_%s_player%02i" % (game_server_guid, player_n)
-        self.sh_pipe_actready_filename = self.prefix + "_actready"
-        self.sh_pipe_obsready_filename = self.prefix + "_obsready"
-        try: os.unlink(self.sh_pipe_actready_filename)
-        except: pass
-        os.mkfifo(self.sh_pipe_actready_filename)
-        try: os.unlink(self.sh_pipe_obsready_filename)
-        except: pass
-        os.mkfifo(self.sh_pipe_obsready_filename)
-        print("Waiting %s" % self.prefix)
+        self.sh_game = sh_game
+        print("Waiting player %i" % player_n)
         self.need_reset = True
         self.need_response_tuple = False
+        self.want_frame = False
 
     def read_env_id_and_create_env(self):
-        self.sh_pipe_actready = open(self.sh_pipe_actready_filename, "rt")
-        self.sh_pipe_obsready = os.open(self.sh_pipe_obsready_filename, os.O_WRONLY)
-        env_id = self.sh_pipe_actready.readline()[:-1]
-        if env_id.find("-v")==-1:
-            raise ValueError("multiplayer client %s sent here invalid environment id '%s'" % (self.prefix, env_id))
+        check = self.sh_game.wait_command(self.player_n, -1)
+        env_id = self.sh_game.env_id(self.player_n)
+        if check!='E' or env_id.find("-v")==-1:
+            self.sh_game.respond(self.player_n, 'X')
+            raise ValueError("multiplayer client %i sent here invalid environment id '%s'" % (self.player_n, env_id))
         #
         # And at this point we know env_id.
         #
@@ -168,52 +147,68 @@ class SharedMemoryPlayerAgent:
         self.env.unwrapped.player_n = self.player_n
         assert isinstance(self.env.observation_space, gym.spaces.Box)
         assert isinstance(self.env.action_space, gym.spaces.Box)
-        self.sh_obs = np.memmap(self.prefix + "_obs",  mode="w+", shape=self.env.observation_space.shape, dtype=np.float32)
-        self.sh_act = np.memmap(self.prefix + "_act",  mode="w+", shape=self.env.action_space.shape, dtype=np.float32)
-        self.sh_rew = np.memmap(self.prefix + "_rew",  mode="w+", shape=(1,), dtype=np.float32)
-        self.sh_rgb = np.memmap(self.prefix + "_rgb",  mode="w+", shape=(self.env.unwrapped.VIDEO_H,self.env.unwrapped.VIDEO_W,3), dtype=np.uint8)
-        os.write(self.sh_pipe_obsready, b'accepted\n')
-
-    def read_and_apply_action(self):
+        self.sh_game.set_sizes(self.player_n,
+            int(np.prod(self.env.observation_space.shape)), int(np.prod(self.env.action_space.shape)),
+            self.env.unwrapped.VIDEO_W, self.env.unwrapped.VIDEO_H)
+        self.sh_obs = np.frombuffer(self.sh_game.obs(self.player_n), dtype=np.float32).reshape(self.env.observation_space.shape)
+        self.sh_act = np.frombuffer(self.sh_game.act(self.player_n), dtype=np.float32).reshape(self.env.action_space.shape)
+        self.sh_rgb = np.frombuffer(self.sh_game.rgb(self.player_n), dtype=np.uint8).reshape((self.env.unwrapped.VIDEO_H,self.env.unwrapped.VIDEO_W,3))
+        self.last_action = np.zeros(shape=self.sh_act.shape, dtype=np.float32)
+        self.sh_game.respond(self.player_n, 'A')
+
+    def handle_command(self):
         """
-        This functions blocks until client sends a command: step() or reset() or requests video image.
-        It quits when user has finished communicating and now expects simulation to advance.
+        Client has a command pending (server found it using wait_any), this doesn't block.
+        Returns True when action is applied and simulation can advance as far as this player is concerned,
+        reset is answered right away, client then sends more commands. Video image request is left
+        pending in want_frame, server renders all of them in one batch (see SharedMemoryServer.render_frames).
         """
-        while 1:
-            if self.passive:
+        check = self.sh_game.wait_command(self.player_n, 0)
+
+        if check=='a':
+            #assert(not self.need_reset)
+            self.last_action[:] = self.sh_act
+            self.env.unwrapped.apply_action(self.sh_act)
+            self.need_response_tuple = True
+            return True
+
+        elif check=='R':
+            obs = self.env.reset()
+            self.sh_obs[:] = obs
+            self.sh_game.respond(self.player_n, 'o')
+            self.need_response_tuple = False # Already answered
+            if self.need_reset:
+                self.done = False
+                self.passive = False
+                self.need_reset = False
+            else:
+                self.done = True  # User has decided he wants to restart, make robot passive
+                self.passive = True
+                self.need_reset = False
                 self.env.unwrapped.apply_action(np.zeros(shape=self.sh_act.shape))
-                return
-            check = self.sh_pipe_actready.readline()[:-1]
-
-            if check=='a':
-                #assert(not self.need_reset)
-                self.env.unwrapped.apply_action(self.sh_act)
-                self.need_response_tuple = True
-                return
-
-            elif check=='R':
-                obs = self.env.reset()
-                self.sh_obs[:] = obs
-                os.write(self.sh_pipe_obsready, b'o\n')
-                self.need_response_tuple = False # Already answered
-                if self.need_reset:
-                    self.done = False
-                    self.passive = False
-                    self.need_reset = False
-                else:
-                    self.done = True  # User has decided he wants to restart, make robot passive
-                    self.passive = True
-                    self.need_reset = False
-
-            elif check=='G':
-                rgb = self.env.render("rgb_array")
-                assert rgb.shape==self.sh_rgb.shape
-                self.sh_rgb[:] = rgb
-                os.write(self.sh_pipe_obsready, b'i\n')
-                self.need_response_tuple = False
+                return True
+            return False
+
+        elif check=='G':
+            self.need_response_tuple = False
+            if hasattr(self.env.unwrapped, "rgb_array_camera"):
+                self.want_frame = True
+                return False
+            rgb = self.env.render("rgb_array")
+            assert rgb.shape==self.sh_rgb.shape
+            self.sh_rgb[:] = rgb
+            self.sh_game.respond(self.player_n, 'i')
+            return False
 
-            else:
-                raise ValueError("multiplayer client %s sent here invalid string '%s'" % (self.prefix, check))
+        else:
+            raise ValueError("multiplayer client %i sent here invalid string '%s'" % (self.player_n, check))
+
+    def apply_straggler_action(self, zero_action):
+        """
+        Client didn't send action before step deadline. Its action will be applied next frame,
+        and it will get response tuple then.
+        """
+        self.env.unwrapped.apply_action(np.zeros(shape=self.sh_act.shape) if zero_action else self.last_action)
 
     def step_and_push_result_tuple(self):
         """
@@ -231,10 +226,38 @@ class SharedMemoryPlayerAgent:
             self.done = True
             self.need_reset = True
         self.sh_obs[:] = state
-        #print("%s [%s]" % (self.prefix + "obs", ", ".join(["%+0.2f"%x for x in state])))
-        self.sh_rew[0] = reward
+        #print("player%02i obs [%s]" % (self.player_n, ", ".join(["%+0.2f"%x for x in state])))
+        self.sh_game.set_rew(self.player_n, reward)
         self.need_response_tuple = False
-        os.write(self.sh_pipe_obsready, b't\n' if not done else b'D\n')   # 't' for tuple
+        self.sh_game.respond(self.player_n, 't' if not done else 'D')   # 't' for tuple
+
+class BotPlayerAgent:
+    """
+    Plays for player_n on server, using zoo policy evaluated in C++ (see cpp-household/policy.h).
+    No client process, no shared memory slot traffic: observations are read from joints and actions
+    applied to joints by cpp_household, env only describes layout in native_bot_setup().
+    """
+    def __init__(self, scene, player_n, env_id, zoo_policy_fn):
+        self.scene = scene
+        self.player_n = player_n
+        self.env_id = env_id
+        self.zoo_policy_fn = zoo_policy_fn
+
+    def read_env_id_and_create_env(self):
+        from roboschool.native_policy import NativeZooPolicy
+        self.env = gym.make(self.env_id)
+        self.env.unwrapped.scene = self.scene
+        self.env.unwrapped.player_n = self.player_n
+        assert hasattr(self.env.unwrapped, "native_bot_setup"), "%s doesn't support bot players" % self.env_id
+        self.policy = NativeZooPolicy(self.zoo_policy_fn, self.env.observation_space, self.env.action_space)
+        print("Player %i is bot, plays %s using %s" % (self.player_n, self.env_id, self.zoo_policy_fn))
+
+    def episode_restart(self):
+        self.bot = cpp_household.BotPlayer(self.policy.policy)
+        self.env.unwrapped.native_bot_setup(self.bot)
+
+    def update_obs_extra(self):
+        self.bot.set_obs_extra(self.env.unwrapped.native_bot_obs_extra())
 
 class SharedMemoryServer:
     """
@@ -245,17 +268,36 @@ class SharedMemoryServer:
     5. It will quit if any of clients malfunction or finish learning.
 
     See demo_race1.py example.
+
+    step_deadline_ms -- if not all players sent actions in that time, simulation steps anyway, repeating
+    their previous action (or applying zero action, if straggler_zero_action). -1 waits for everybody.
+
+    bots -- {player_n: (env_id, zoo_policy_file)} players played on server by BotPlayerAgent,
+    for example {0: ("RoboschoolPong-v1", "agent_zoo/RoboschoolPong_v0_2017may1.py")}.
     """
-    def __init__(self, scene, game_server_guid, want_test_window):
+    def __init__(self, scene, game_server_guid, want_test_window, obs_max=1024, act_max=256, rgb_max=1024*768*3,
+            step_deadline_ms=-1, straggler_zero_action=False, bots={}):
         self.scene = scene
         self.plist = []
+        self.remote = []
+        self.bots = []
         self.want_test_window = want_test_window
+        self.step_deadline_ms = step_deadline_ms
+        self.straggler_zero_action = straggler_zero_action
+        self.sh_game = cpp_household.SharedMemoryGame(game_server_guid, scene.players_count, obs_max, act_max, rgb_max)
         for n in range(scene.players_count):
-            player = SharedMemoryPlayerAgent(
-                scene,
-                game_server_guid,
-                player_n=n)
+            if n in bots:
+                env_id, zoo_policy_fn = bots[n]
+                player = BotPlayerAgent(scene, n, env_id, zoo_policy_fn)
+                self.bots.append(player)
+            else:
+                player = SharedMemoryPlayerAgent(
+                    scene,
+                    self.sh_game,
+                    player_n=n)
+                self.remote.append(player)
             self.plist.append(player)
+        assert self.remote, "at least one player must be remote"
 
     def serve_forever(self):
         for p in self.plist:
@@ -266,25 +308,76 @@ class SharedMemoryServer:
         while still_open:
             episode += 1
             self.scene.episode_restart()
-            for p in self.plist:
+            for p in self.remote:
                 p.done = False
                 p.passive = False
+            for b in self.bots:
+                b.episode_restart()
 
             frame = 0
             while still_open:
                 if self.want_test_window:
                     still_open = self.scene.test_window()
 
-                for p in self.plist:
-                    p.read_and_apply_action()
+                self.gather_actions()
+                if self.bots:
+                    for b in self.bots:
+                        b.update_obs_extra()
+                    self.scene.cpp_world.bots_step([b.bot for b in self.bots])
 
                 self.scene.global_step()
                 frame += 1
 
-                for p in self.plist:
+                for p in self.remote:
                     p.step_and_push_result_tuple()
 
-                done = [1 for p in self.plist if p.done]
-                if len(done)==len(self.plist): break
+                done = [1 for p in self.remote if p.done]
+                if len(done)==len(self.remote): break
 
             #print("episode %i finished after %i frames" % (episode, frame))
+
+    def gather_actions(self):
+        """
+        Waits for all active players at once, handles commands in order they arrive.
+        """
+        waiting = []
+        for p in self.remote:
+            if p.passive:
+                p.env.unwrapped.apply_action(np.zeros(shape=p.sh_act.shape))
+            else:
+                waiting.append(p.player_n)
+        self.sh_game.step_begin(self.step_deadline_ms)
+        while waiting:
+            n = self.sh_game.poll_any([n for n in waiting if not self.plist[n].want_frame])
+            if n < 0:
+                if self.render_frames(): continue  # all requests that arrived so far, rendered together
+                n = self.sh_game.wait_any(waiting)
+                if n < 0: break  # deadline
+            if self.plist[n].handle_command():
+                waiting.remove(n)
+        self.render_frames()
+        if waiting:
+            self.sh_game.stragglers(waiting)
+            for n in waiting:
+                self.plist[n].apply_straggler_action(self.straggler_zero_action)
+
+    def render_frames(self):
+        """
+        One batched render for all players that asked for video image, each image goes straight
+        into that player's shared memory. Players looking through the same camera get one render.
+        """
+        want = [p for p in self.remote if p.want_frame]
+        if not want: return False
+        self.scene.cpp_world.render_cameras_rgb(
+            [p.env.unwrapped.rgb_array_camera() for p in want],
+            [p.sh_rgb for p in want])  # numpy views of shared memory
+        for p in want:
+            p.want_frame = False
+            self.sh_game.respond(p.player_n, 'i')
+        return True
+
+    def latency_stats(self):
+        """
+        Per player: time between response and next command arrival, in microseconds, and count of steps it was late for.
+        """
+        return self.sh_game.latency_stats()
@@ -0,0 +1,48 @@
+import os
+import numpy as np
+from roboschool.scene_abstract import cpp_household
+
+def zoo_weights(fn):
+    """
+    Weights from agent_zoo: fn can be .weights file, or policy script. Scripts with weights
+    inside (v0) are executed without running demo, for scripts with .weights file next to them (v1)
+    only .weights is read, so tensorflow is not needed.
+    """
+    weights_fn = os.path.splitext(fn)[0] + ".weights"
+    if os.path.exists(weights_fn):
+        fn = weights_fn
+    d = {"__name__": "zoo_weights"}
+    exec(open(fn).read(), d)
+    return d
+
+class NativeZooPolicy:
+    """
+    Zoo MLP (dense1, dense2, ... with relu, then final) evaluated by cpp_household.MlpPolicy,
+    same results as numpy or tensorflow version. The same policy object can be given to
+    server-side code that calls it without python.
+    """
+    def __init__(self, fn, ob_space=None, ac_space=None):
+        w = zoo_weights(fn)
+        self.policy = cpp_household.MlpPolicy()
+        n = 1
+        while "weights_dense%i_w" % n in w:
+            self._layer(w, "dense%i" % n, True)
+            n += 1
+        self._layer(w, "final", False)
+        if ob_space is not None: assert ob_space.shape==(self.policy.obs_n,)
+        if ac_space is not None: assert ac_space.shape==(self.policy.act_n,)
+
+    def _layer(self, w, name, relu):
+        self.policy.layer_add(
+            np.ascontiguousarray(w["weights_%s_w" % name], dtype=np.float32),
+            np.ascontiguousarray(w["weights_%s_b" % name], dtype=np.float32),
+            relu)
+
+    def act(self, ob, cx=None):
+        """
+        One observation, or batch of shape (N, obs_n).
+        """
+        ob = np.ascontiguousarray(ob, dtype=np.float32)
+        a = np.empty(ob.shape[:-1] + (self.policy.act_n,), dtype=np.float32)
+        self.policy.act(ob, a)
+        return a